@@ -23,6 +23,9 @@ BuildRequires:  pkgconfig(tizen-extension-server)
 BuildRequires:  pkgconfig(capi-system-peripheral-io)
 BuildRequires:	pkgconfig(xdg-shell-unstable-v6-server)
 BuildRequires:	pkgconfig(tizen-extension-server)
+BuildRequires:	pkgconfig(presentation-time-server)
+BuildRequires:	pkgconfig(wayland-client)
+BuildRequires:	pkgconfig(wayland-scanner)
 
 Requires: pepper pepper-keyrouter pepper-devicemgr pepper-evdev
 Requires: pepper-xkb xkeyboard-config xkb-tizen-data
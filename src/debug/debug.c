@@ -45,6 +45,8 @@
 #define CONNECTED_CLIENTS		"connected_clients"
 #define CLIENT_RESOURCES		"reslist"
 #define KEYMAP				"keymap"
+#define OUTPUT_STATUS			"output_status"
+#define SHELL_STATUS			"shell_status"
 #define HELP_MSG			"help"
 
 typedef struct
@@ -81,6 +83,8 @@ _headless_debug_usage()
 	fprintf(stdout, "\t %s\n", CONNECTED_CLIENTS);
 	fprintf(stdout, "\t %s\n", CLIENT_RESOURCES);
 	fprintf(stdout, "\t %s\n", KEYMAP);
+	fprintf(stdout, "\t %s\n", OUTPUT_STATUS);
+	fprintf(stdout, "\t %s\n", SHELL_STATUS);
 	fprintf(stdout, "\t %s\n", HELP_MSG);
 
 	fprintf(stdout, "\nTo execute commands, just create/remove/update a file with the commands above.\n");
@@ -94,6 +98,8 @@ _headless_debug_usage()
 	fprintf(stdout, "\t # winfo connected_clients\t : display connected clients information\n");
 	fprintf(stdout, "\t # winfo reslist\t\t : display each resources information of connected clients\n");
 	fprintf(stdout, "\t # winfo keymap\t\t : display current xkb keymap\n");
+	fprintf(stdout, "\t # winfo output_status\t\t : display LED output statistics\n");
+	fprintf(stdout, "\t # winfo shell_status\t\t : display shell statistics\n");
 	fprintf(stdout, "\t # winfo help\t\t\t : display this help message\n");
 }
 
@@ -338,6 +344,22 @@ _headless_debug_keymap(headless_debug_t *hdebug, void *data)
 	}
 }
 
+static void
+_headless_debug_output_status(headless_debug_t *hdebug, void *data)
+{
+	(void) data;
+
+	headless_output_debug_status(hdebug->compositor);
+}
+
+static void
+_headless_debug_shell_status(headless_debug_t *hdebug, void *data)
+{
+	(void) data;
+
+	headless_shell_debug_status(hdebug->compositor);
+}
+
 static const headless_debug_action_t debug_actions[] =
 {
 	{ STDOUT_REDIR,  _headless_debug_redir_stdout, NULL },
@@ -349,6 +371,8 @@ static const headless_debug_action_t debug_actions[] =
 	{ CONNECTED_CLIENTS, _headless_debug_connected_clients, NULL },
 	{ CLIENT_RESOURCES, _headless_debug_connected_clients, NULL },
 	{ KEYMAP, _headless_debug_keymap, NULL },
+	{ OUTPUT_STATUS, _headless_debug_output_status, NULL },
+	{ SHELL_STATUS, _headless_debug_shell_status, NULL },
 	{ HELP_MSG, _headless_debug_dummy, NULL },
 };
 
@@ -70,6 +70,10 @@ int main(int argc, char *argv[])
 		pepper_log_dlog_enable(1);
 	}
 
+	/* light the LEDs first, the boot animation plays while the rest starts */
+	if (!headless_output_boot())
+		PEPPER_ERROR("headless_output_boot() failed\n");
+
 	socket_name = getenv("WAYLAND_DISPLAY");
 
 	if (!socket_name)
@@ -80,7 +84,7 @@ int main(int argc, char *argv[])
 
 	/* create pepper compositir */
 	compositor = pepper_compositor_create(socket_name);
-	PEPPER_CHECK(compositor, return EXIT_FAILURE, "Failed to create compositor !");
+	PEPPER_CHECK(compositor, goto fail, "Failed to create compositor !");
 
 	/* Init event trace */
 	ret = headless_debug_init(compositor);
@@ -113,4 +117,8 @@ end:
 	pepper_compositor_destroy(compositor);
 
 	return EXIT_SUCCESS;
+
+fail:
+	headless_output_deinit(NULL);
+	return EXIT_FAILURE;
 }
@@ -31,12 +31,35 @@ extern "C" {
 #endif
 
 /* APIs for headless_output */
+#define HEADLESS_OUTPUT_MAX_KEYFRAMES	256	//keyframes of one sequence
+
+typedef enum {
+	HEADLESS_OUTPUT_EASING_STEP,	/* hold the keyframe */
+	HEADLESS_OUTPUT_EASING_LINEAR,
+	HEADLESS_OUTPUT_EASING_IN,
+	HEADLESS_OUTPUT_EASING_OUT,
+	HEADLESS_OUTPUT_EASING_IN_OUT,
+} headless_output_easing_t;
+
+typedef struct {
+	const void *pixels;	/* layout_w x layout_h 4byte pixels, laid out as a client buffer */
+	uint32_t duration_ms;	/* time to go to the next keyframe (the first one after the last) */
+	headless_output_easing_t easing;
+} headless_output_keyframe_t;
+
+PEPPER_API pepper_bool_t headless_output_boot(void);
 PEPPER_API pepper_bool_t headless_output_init(pepper_compositor_t *compositor);
 PEPPER_API void headless_output_deinit(pepper_compositor_t *compositor);
+PEPPER_API void headless_output_debug_status(pepper_compositor_t *compositor);
+PEPPER_API void headless_output_get_layout(pepper_compositor_t *compositor, int *width, int *height);
+PEPPER_API pepper_bool_t headless_output_play_keyframes(pepper_compositor_t *compositor,
+						const headless_output_keyframe_t *keyframes, int count, int repeat);
+PEPPER_API void headless_output_stop_keyframes(pepper_compositor_t *compositor);
 
 /* APIs for headless_shell */
 PEPPER_API pepper_bool_t headless_shell_init(pepper_compositor_t *compositor);
 PEPPER_API void headless_shell_deinit(pepper_compositor_t *compositor);
+PEPPER_API void headless_shell_debug_status(pepper_compositor_t *compositor);
 
 /* APIs for headless_input */
 PEPPER_API pepper_bool_t headless_input_init(pepper_compositor_t *compositor);
@@ -29,34 +29,177 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <peripheral_io.h>
+#include <pthread.h>
 
 #define B_OFF_SET 1
 #define G_OFF_SET 2
 #define R_OFF_SET 3
 
 #define BITRATE 8000000
+#define HL_UI_LED_SPI_BUS 0
+#define HL_UI_LED_SPI_DEV 1
 
-typedef struct{
+/* back (encoding), pending (queued) and front (on the wire) frames */
+#define HL_UI_LED_NUM_FRAMES 3
+#define HL_UI_LED_FRAME_FRESH 0x100
+#define HL_UI_LED_FRAME_INDEX(x) ((x) & 0xFF)
+/* start frame + LED data + end frame */
+#define HL_UI_LED_FRAME_LEN(num) (4 + 4 * (num) + ((num) + 15) / 16 + 1)
+
+typedef struct _HL_UI_LED HL_UI_LED;
+
+/* parameters of the drivers, each driver only uses its own fields */
+typedef struct {
+	int spi_bus;
+	int spi_dev;
+	uint32_t bitrate;
+	const char *path;	/* virtual: ring file, NULL for an anonymous memfd */
+	uint32_t slots;	/* virtual: number of frames kept in the ring */
+	int throttle;	/* virtual: take as long as the SPI transfer at 'bitrate' */
+	uint8_t brightness;	/* of the first (clear) frame, as for HL_UI_LED_Change_Brightness */
+} HL_UI_LED_Param;
+
+/* the transport below the frame encoding, encoded frames are written as is */
+typedef struct {
+	const char *name;
+	int  (*open)(HL_UI_LED *handle, const HL_UI_LED_Param *param);
+	int  (*write)(HL_UI_LED *handle, const uint8_t *data, uint32_t len);
+	void (*close)(HL_UI_LED *handle);
+} HL_UI_LED_Driver;
+
+extern const HL_UI_LED_Driver HL_UI_LED_Driver_Spi;
+extern const HL_UI_LED_Driver HL_UI_LED_Driver_Virtual;
+
+/*
+ * The virtual driver keeps the last frames in a shared memory ring:
+ * a HL_UI_LED_Virtual_Ring header followed by 'slots' slots of
+ * HL_UI_LED_VIRTUAL_SLOT_SIZE(frame_len) bytes. Frame n (from 1) goes to
+ * slot (n - 1) % slots. A slot's sequence is 0 while it is being written,
+ * so readers load it (acquire), copy the slot, issue an acquire fence and
+ * check that the sequence did not change.
+ */
+#define HL_UI_LED_VIRTUAL_MAGIC 0x564c4c48	/* "HLLV" */
+#define HL_UI_LED_VIRTUAL_SLOT_SIZE(len) ((sizeof(HL_UI_LED_Virtual_Slot) + (len) + 7) & ~(size_t)7)
+
+typedef struct {
+	uint32_t magic;
+	uint32_t number;	/* number of leds */
+	uint32_t frame_len;	/* bytes reserved for a frame in each slot */
+	uint32_t slots;
+	uint64_t sequence;	/* number of frames written so far */
+} HL_UI_LED_Virtual_Ring;
+
+typedef struct {
+	uint64_t sequence;
+	uint32_t len;
+	uint32_t reserved;
+	/* followed by the encoded frame */
+} HL_UI_LED_Virtual_Slot;
+
+struct _HL_UI_LED {
 	uint32_t number;
-	peripheral_spi_h hnd_spi;
-	uint8_t  *pixels;
+	const HL_UI_LED_Driver *driver;
+	void *driver_data;
+	uint8_t  *pixels;	/* LED data of the back frame */
 	uint8_t  brightness;
-}HL_UI_LED;
+
+	/* changes staged between HL_UI_LED_Begin and HL_UI_LED_Commit */
+	int txn_depth;
+	int txn_dirty;
+
+	/* wire-format frames, start/end frames are written once at init */
+	uint8_t  *frames[HL_UI_LED_NUM_FRAMES];
+	uint32_t frame_len;
+	uint32_t back;
+	uint32_t last;	/* frame sent or queued most recently */
+	int stale;	/* back frame is behind 'last' */
+
+	/* asynchronous writer, frames are handed over through 'pending' */
+	pthread_t writer;
+	int writer_running;
+	int quit;
+	int kick_fd;
+	int done_fd;
+	uint32_t pending;
+	uint32_t front;
+
+	uint64_t frames_written;
+	uint64_t bytes_written;
+	uint64_t frames_dropped;
+	uint64_t done_nsec;	/* CLOCK_MONOTONIC, end of the last frame transfer */
+	int done_complete;	/* the last frame was sent in full */
+
+	/*
+	 * truncated frames: LED data as last transmitted, owned by whoever
+	 * writes the frames (the writer thread when it is running)
+	 */
+	int truncate;
+	int wire_valid;
+	uint8_t  *wire;
+	uint8_t  *tx;	/* scratch for a prefix of a frame */
+	uint64_t frames_truncated;
+	uint64_t frames_unchanged;
+};
 
 /**
  * @brief: Initialise a set of apa102 LEDs
  *
- * @param[in] led_num: Number of leds (0-255)
+ * @param[in] led_num: Number of leds
  *
  * @returns:  pointer of handler\ Success
  *            NULL\ Error
  */
 HL_UI_LED *HL_UI_LED_Init(uint32_t led_num);
 
+/**
+ * @brief: Initialise a set of apa102 LEDs on a given SPI device
+ *
+ * @param[in] led_num: Number of leds
+ * @param[in] bus: SPI bus number
+ * @param[in] dev: SPI chip select
+ * @param[in] bitrate: SPI clock frequency (Hz)
+ *
+ * @returns:  pointer of handler\ Success
+ *            NULL\ Error
+ */
+HL_UI_LED *HL_UI_LED_Init_Spi(uint32_t led_num, int bus, int dev, uint32_t bitrate);
+
+/**
+ * @brief: Initialise a set of apa102 LEDs on a given driver
+ *
+ * @param[in] led_num: Number of leds
+ * @param[in] driver: Driver writing the encoded frames
+ * @param[in] param: Parameters of the driver
+ *
+ * @returns:  pointer of handler\ Success
+ *            NULL\ Error
+ */
+HL_UI_LED *HL_UI_LED_Init_Driver(uint32_t led_num, const HL_UI_LED_Driver *driver, const HL_UI_LED_Param *param);
+
+/**
+ * @brief: Find a driver by name ("spi", "virtual")
+ *
+ * @returns:  driver\ Success
+ *            NULL\ Unknown name
+ */
+const HL_UI_LED_Driver *HL_UI_LED_Find_Driver(const char *name);
+
+/**
+ * @brief: Get the fd of the virtual driver's ring (see HL_UI_LED_Virtual_Ring)
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ *
+ * @returns: fd\ virtual driver
+ *           -1\ other drivers
+ */
+int HL_UI_LED_Virtual_Get_Fd(HL_UI_LED *handle);
+
 /**
  * @brief: Change the global brightness and fresh
  *
+ * Use HL_UI_LED_Param.brightness to open the LEDs at a given brightness
+ * without a frame of its own.
+ *
  * @param[in] handle: handler of HL_UI_LED
  * @param[in] brightness: New brightness value
  */
@@ -74,7 +217,7 @@ int HL_UI_LED_Get_Brightness(HL_UI_LED *handle);
  * @brief: Set color for a specific pixel by giving R, G and B value separately
  *
  * @param[in] handle: handler of HL_UI_LED
- * @param[in] index: Index of the target led (0-255)
+ * @param[in] index: Index of the target led
  * @param[in] red: Intensity of red colour (0-255)
  * @param[in] green: Intensity of green colour (0-255)
  * @param[in] blue: Intensity of blue colour (0-255)
@@ -85,7 +228,7 @@ void HL_UI_LED_Set_Pixel_RGB(HL_UI_LED *handle, uint32_t index, uint8_t red, uin
  * @brief: Get colour form a specific pixel for R, G and B separately
  *
  * @param[in] handle: handler of HL_UI_LED
- * @param[in] index: Index of the target led (0-255)
+ * @param[in] index: Index of the target led
  * @param[out] red: Intensity of red colour (0-255)
  * @param[out] green: Intensity of green colour (0-255)
  * @param[out] blue: Intensity of blue colour (0-255)
@@ -96,7 +239,7 @@ void HL_UI_LED_Get_Pixel_RGB(HL_UI_LED *handle, uint32_t index, uint8_t *red, ui
  * @brief: Set color for a specific pixel by using 4byte date
  *
  * @param[in] handle: handler of HL_UI_LED
- * @param[in] index: Index of the target led (0-255)
+ * @param[in] index: Index of the target led
  * @param[in] red: Intensity of red colour (0-255)
  * @param[in] green: Intensity of green colour (0-255)
  * @param[in] blue: Intensity of blue colour (0-255)
@@ -109,12 +252,42 @@ void HL_UI_LED_Set_Pixel_4byte(HL_UI_LED *handle, uint32_t index, uint32_t colou
  * @brief: Get colour form a specific pixel
  *
  * @param[in] handle: handler of HL_UI_LED
- * @param[in] index: Index of the target led (0-255)
+ * @param[in] index: Index of the target led
  *
  * @returns: 32 bits colour data
  */
 uint32_t HL_UI_LED_Get_Pixel_4byte(HL_UI_LED *handle, uint32_t index);
 
+/**
+ * @brief: Set colours of the first pixels from an array of 4byte data
+ *
+ * Pixels use the same byte layout as HL_UI_LED_Set_Pixel_4byte and are
+ * converted into the frame in a single pass, brightness included.
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ * @param[in] data: 4byte colour data of count pixels
+ * @param[in] count: Number of pixels to update, starting from index 0
+ */
+void HL_UI_LED_Set_Pixels_4byte(HL_UI_LED *handle, const void *data, uint32_t count);
+
+/**
+ * @brief: Set all the LEDs from LED data encoded beforehand
+ *
+ * The data is copied as is, e.g. frames prepared once with hl_ui_led_convert
+ * and the handle's brightness header. Nothing is converted per call.
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ * @param[in] data: LED data, 4 bytes per LED for all the LEDs
+ */
+void HL_UI_LED_Load_Encoded(HL_UI_LED *handle, const uint8_t *data);
+
+/**
+ * @brief: Get the brightness header byte of each LED (for hl_ui_led_convert)
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ */
+uint8_t HL_UI_LED_Get_Header(HL_UI_LED *handle);
+
 /**
  * @brief: Clear all the pixels
  *
@@ -124,9 +297,111 @@ void HL_UI_LED_Clear_All(HL_UI_LED *handle);
 
 /**
  * @brief: Refresh display (After modifing pixel colour)
+ *
+ * Inside a transaction the refresh is left to HL_UI_LED_Commit.
  */
 int HL_UI_LED_Refresh(HL_UI_LED *handle);
 
+/**
+ * @brief: Start staging changes
+ *
+ * Until the matching HL_UI_LED_Commit, pixel, brightness and clear
+ * operations only change the back frame and nothing is sent. Transactions
+ * can be nested, the outermost commit sends the frame.
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ */
+void HL_UI_LED_Begin(HL_UI_LED *handle);
+
+/**
+ * @brief: End a transaction, sending all the staged changes as one frame
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ *
+ * @returns:  0\ Frame sent (or queued to the writer)
+ *            1\ Nothing to send (nothing staged, or an outer transaction is open)
+ *           <0\ Error
+ */
+int HL_UI_LED_Commit(HL_UI_LED *handle);
+
+/**
+ * @brief: Get the number of frames and bytes sent to the device
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ * @param[out] frames: Number of frames written (can be NULL)
+ * @param[out] bytes: Number of bytes written (can be NULL)
+ * @param[out] dropped: Number of frames replaced before being written (can be NULL)
+ */
+void HL_UI_LED_Get_Stats(HL_UI_LED *handle, uint64_t *frames, uint64_t *bytes, uint64_t *dropped);
+
+/**
+ * @brief: Get the time the last frame was completely sent
+ *
+ * The LEDs latch a frame when its transfer ends, so this is when the frame
+ * became visible. A frame not sent because nothing changed counts as done
+ * when it was checked.
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ * @param[out] complete: 1 if the whole frame was transferred, 0 if it was
+ *                       truncated or not sent at all (can be NULL)
+ *
+ * @returns: CLOCK_MONOTONIC time in ns, 0 before the first frame
+ */
+uint64_t HL_UI_LED_Get_Done_Time(HL_UI_LED *handle, int *complete);
+
+/**
+ * @brief: Send frames only up to the last LED changed since the previous
+ *         transmission (on by default)
+ *
+ * APA102 data shifts down the chain, so the LEDs after the last changed one
+ * keep their colours when the frame stops early. Unchanged frames are not
+ * sent at all. Must be called before HL_UI_LED_Start_Writer.
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ * @param[in] enable: 0 to always send full frames
+ */
+void HL_UI_LED_Set_Truncate(HL_UI_LED *handle, int enable);
+
+/**
+ * @brief: Get the number of frames cut short or not sent as nothing changed
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ * @param[out] truncated: Number of frames sent up to the last changed LED (can be NULL)
+ * @param[out] unchanged: Number of frames not sent (can be NULL)
+ */
+void HL_UI_LED_Get_Truncate_Stats(HL_UI_LED *handle, uint64_t *truncated, uint64_t *unchanged);
+
+/**
+ * @brief: Start a writer thread which owns the driver writes
+ *
+ * After this, HL_UI_LED_Refresh only queues the encoded frame and returns.
+ * If the writer has not picked up the previous frame yet, it is replaced
+ * by the new one (latest frame wins).
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ *
+ * @returns:  0\ Success
+ *           <0\ Error
+ */
+int HL_UI_LED_Start_Writer(HL_UI_LED *handle);
+
+/**
+ * @brief: Write out the queued frame and stop the writer thread
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ */
+void HL_UI_LED_Stop_Writer(HL_UI_LED *handle);
+
+/**
+ * @brief: Get the eventfd signalled each time the writer finished a frame
+ *
+ * @param[in] handle: handler of HL_UI_LED
+ *
+ * @returns: eventfd\ writer is running
+ *           -1\ frames are written synchronously
+ */
+int HL_UI_LED_Get_Done_Fd(HL_UI_LED *handle);
+
 /**
  * @brief: Show display (After modifing pixel colour)
  *
@@ -136,7 +411,23 @@ int HL_UI_LED_Show(HL_UI_LED *handle);
 
 
 /**
- * @brief: Close SPI file, release memory
+ * @brief: Convert 4byte pixels into APA102 LED data
+ *         (SSE2/AVX2/NEON variant picked at runtime, scalar fallback)
+ *
+ * @param[out] dst: LED data, 4 bytes per LED
+ * @param[in] src: 4byte colour data
+ * @param[in] count: Number of pixels
+ * @param[in] header: Brightness header byte of each LED
+ */
+void hl_ui_led_convert(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t header);
+
+/**
+ * @brief: Name of the conversion kernel in use
+ */
+const char *hl_ui_led_convert_name(void);
+
+/**
+ * @brief: Close the driver, release memory
  *
  * @param[in] handle: handler of HL_UI_LED
  */
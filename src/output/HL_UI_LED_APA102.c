@@ -23,85 +23,161 @@
  * SOFTWARE.
  */
 
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/eventfd.h>
+
 #include "HL_UI_LED.h"
 
-#define SUCCESS_FLAG 760302
-#define RETRY_TIMES 3
+static void
+hl_ui_led_free(HL_UI_LED *handle)
+{
+	int i;
+
+	for (i = 0; i < HL_UI_LED_NUM_FRAMES; i++)
+	{
+		if (handle->frames[i])
+			free(handle->frames[i]);
+	}
+
+	if (handle->wire)
+		free(handle->wire);
+	if (handle->tx)
+		free(handle->tx);
 
-#define SPI_BUS 0
-#define SPI_DEV 1
+	free(handle);
+}
+
+static void
+hl_ui_led_set_back(HL_UI_LED *handle, uint32_t slot)
+{
+	handle->back = slot;
+	handle->pixels = handle->frames[slot] + 4;
+	handle->stale = 1;
+}
+
+// the back frame is reused lazily, bring it up to date before partial updates
+static void
+hl_ui_led_sync_back(HL_UI_LED *handle)
+{
+	if (!handle->stale)
+		return;
+
+	memcpy(handle->pixels, handle->frames[handle->last] + 4, handle->number * 4);
+	handle->stale = 0;
+}
 
 HL_UI_LED *
 HL_UI_LED_Init(uint32_t led_num)
+{
+	return HL_UI_LED_Init_Spi(led_num, HL_UI_LED_SPI_BUS, HL_UI_LED_SPI_DEV, BITRATE);
+}
+
+HL_UI_LED *
+HL_UI_LED_Init_Spi(uint32_t led_num, int bus, int dev, uint32_t bitrate)
+{
+	HL_UI_LED_Param param;
+
+	memset(&param, 0, sizeof(param));
+	param.spi_bus = bus;
+	param.spi_dev = dev;
+	param.bitrate = bitrate;
+	param.brightness = 0xFF;
+
+	return HL_UI_LED_Init_Driver(led_num, &HL_UI_LED_Driver_Spi, &param);
+}
+
+HL_UI_LED *
+HL_UI_LED_Init_Driver(uint32_t led_num, const HL_UI_LED_Driver *driver, const HL_UI_LED_Param *param)
 {
 	HL_UI_LED *handle;
-	int count = 0;
-	int ret;
+	int i;
 
-	handle = (HL_UI_LED*)malloc(sizeof(HL_UI_LED));
+	handle = (HL_UI_LED*)calloc(1, sizeof(HL_UI_LED));
 	if(handle == NULL)
 	{
 		return NULL;
 	}
 	handle->number = led_num;
-	handle->brightness = 0xFF;
-	handle->pixels = (uint8_t *)malloc(handle->number * 4);
-	if(handle->pixels == NULL)
-	{
-		free(handle);
-		return NULL;
-	}
+	if (param->brightness > 31)
+		handle->brightness = 0xFF;
+	else
+		handle->brightness = 0xE0 | param->brightness;
+	handle->kick_fd = -1;
+	handle->done_fd = -1;
 
-	while(count < RETRY_TIMES)
+	// start and end frames stay zero, only LED data is updated per frame
+	handle->frame_len = HL_UI_LED_FRAME_LEN(handle->number);
+	for (i = 0; i < HL_UI_LED_NUM_FRAMES; i++)
 	{
-		if(peripheral_spi_open(SPI_BUS, SPI_DEV, &(handle->hnd_spi)) == 0)
+		handle->frames[i] = (uint8_t *)calloc(1, handle->frame_len);
+		if (handle->frames[i] == NULL)
 		{
-			printf("spi open success!\n");
-			count = SUCCESS_FLAG;
-			if((ret = peripheral_spi_set_frequency(handle->hnd_spi, BITRATE)) != 0)
-			{
-				printf("Frequency Failed : 0x%x\n", ret);
-			}
-			if((ret = peripheral_spi_set_bits_per_word(handle->hnd_spi, 8)) != 0)
-			{
-				printf("BIT_WORD Failed : 0x%x\n", ret);
-			}
-			if((ret = peripheral_spi_set_bit_order(handle->hnd_spi,PERIPHERAL_SPI_BIT_ORDER_MSB)) != 0)
-			{
-				printf("BIT_ORDER Failed : 0x%x\n", ret);
-			}
-			if((ret = peripheral_spi_set_mode(handle->hnd_spi,PERIPHERAL_SPI_MODE_1)) != 0)
-			{
-				printf("SPI Mode Failed : 0x%x\n", ret);
-			}
-			break;
-		}
-		else
-		{
-			count++;
-			continue;
+			hl_ui_led_free(handle);
+			return NULL;
 		}
 	}
-	if(count == SUCCESS_FLAG)
+	handle->wire = (uint8_t *)calloc(1, handle->number * 4);
+	handle->tx = (uint8_t *)calloc(1, handle->frame_len);
+	if (handle->wire == NULL || handle->tx == NULL)
 	{
-		HL_UI_LED_Clear_All(handle);
-		return handle;
+		hl_ui_led_free(handle);
+		return NULL;
 	}
-	else
+	handle->truncate = 1;
+
+	handle->pending = 1;
+	handle->front = 2;
+	handle->last = handle->pending;
+	hl_ui_led_set_back(handle, 0);
+
+	handle->driver = driver;
+	if (driver->open(handle, param) != 0)
 	{
-		free(handle->pixels);
-		free(handle);
+		fprintf(stdout, "[Error] can't open %s driver\n", driver->name);
+		hl_ui_led_free(handle);
 		return NULL;
 	}
+
+	HL_UI_LED_Clear_All(handle);
+	return handle;
+}
+
+const HL_UI_LED_Driver *
+HL_UI_LED_Find_Driver(const char *name)
+{
+	static const HL_UI_LED_Driver *drivers[] =
+	{
+		&HL_UI_LED_Driver_Spi,
+		&HL_UI_LED_Driver_Virtual,
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof(drivers) / sizeof(drivers[0]); i++)
+	{
+		if (!strcmp(drivers[i]->name, name))
+			return drivers[i];
+	}
+
+	return NULL;
 }
 
 void
 HL_UI_LED_Change_Brightness(HL_UI_LED *handle, uint8_t brightness)
 {
+	uint8_t *ptr;
+	uint32_t i;
+
 	if (brightness > 31)
 		handle->brightness = 0xFF;
 	else
 		handle->brightness = 0xE0 | (0x1F & brightness);
+
+	hl_ui_led_sync_back(handle);
+	for(ptr = handle->pixels, i=0; i<handle->number; i++, ptr += 4)
+		ptr[0] = handle->brightness;
+
 	HL_UI_LED_Refresh(handle);
 }
 
@@ -115,7 +191,11 @@ void
 HL_UI_LED_Set_Pixel_RGB(HL_UI_LED *handle, uint32_t index, uint8_t red, uint8_t green, uint8_t blue)
 {
 	if (index < handle->number) {
-		uint8_t *ptr = &(handle->pixels[index * 4]);
+		uint8_t *ptr;
+
+		hl_ui_led_sync_back(handle);
+		handle->txn_dirty = 1;
+		ptr = &(handle->pixels[index * 4]);
 		ptr[R_OFF_SET] = red;
 		ptr[G_OFF_SET] = green;
 		ptr[B_OFF_SET] = blue;
@@ -126,7 +206,12 @@ void
 HL_UI_LED_Get_Pixel_RGB(HL_UI_LED *handle, uint32_t index, uint8_t *red, uint8_t *green, uint8_t *blue)
 {
 	if (index < handle->number) {
-		uint8_t *ptr = &(handle->pixels[index * 4]);
+		uint8_t *ptr;
+
+		if (handle->stale)
+			ptr = handle->frames[handle->last] + 4 + index * 4;
+		else
+			ptr = &(handle->pixels[index * 4]);
 		*red = ptr[R_OFF_SET];
 		*green = ptr[G_OFF_SET];
 		*blue = ptr[B_OFF_SET];
@@ -157,63 +242,334 @@ HL_UI_LED_Get_Pixel_4byte(HL_UI_LED *handle, uint32_t index)
 	return colour;
 }
 
+void
+HL_UI_LED_Set_Pixels_4byte(HL_UI_LED *handle, const void *data, uint32_t count)
+{
+	if (count > handle->number)
+		count = handle->number;
+
+	// LEDs beyond count keep their colour
+	if (count < handle->number)
+		hl_ui_led_sync_back(handle);
+	else
+		handle->stale = 0;
+
+	hl_ui_led_convert(handle->pixels, (const uint8_t *)data, count, handle->brightness);
+	handle->txn_dirty = 1;
+}
+
+void
+HL_UI_LED_Load_Encoded(HL_UI_LED *handle, const uint8_t *data)
+{
+	memcpy(handle->pixels, data, handle->number * 4);
+	handle->stale = 0;
+	handle->txn_dirty = 1;
+}
+
+uint8_t
+HL_UI_LED_Get_Header(HL_UI_LED *handle)
+{
+	return handle->brightness;
+}
+
 void
 HL_UI_LED_Clear_All(HL_UI_LED *handle)
 {
 	uint8_t *ptr;
 	uint32_t i;
 	for(ptr = handle->pixels, i=0; i<handle->number; i++, ptr += 4) {
+		ptr[0] = handle->brightness;
 		ptr[1] = 0x00;
 		ptr[2] = 0x00;
 		ptr[3] = 0x00;
 	}
+	handle->stale = 0;
 	HL_UI_LED_Refresh(handle);
 }
 
-int
-HL_UI_LED_Refresh(HL_UI_LED *handle)
+static void
+hl_ui_led_mark_done(HL_UI_LED *handle, int complete)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	__atomic_store_n(&handle->done_complete, complete, __ATOMIC_RELAXED);
+	__atomic_store_n(&handle->done_nsec, (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec,
+					__ATOMIC_RELEASE);
+}
+
+// number of LEDs up to the last one that differs from what is on the wire
+static uint32_t
+hl_ui_led_find_dirty(HL_UI_LED *handle, const uint8_t *data)
 {
+	const uint32_t *cur = (const uint32_t *)data;
+	const uint32_t *old = (const uint32_t *)handle->wire;
+	uint32_t n = handle->number;
+
+	if (!handle->truncate || !handle->wire_valid)
+		return n;
+
+	while (n > 0 && cur[n - 1] == old[n - 1])
+		n--;
+
+	return n;
+}
+
+static int
+hl_ui_led_write_frame(HL_UI_LED *handle, uint8_t *tx)
+{
+	uint32_t dirty, len;
 	int ret;
-	uint32_t i;
-	uint32_t buf_len = 4 + 4 * handle->number + (handle->number + 15) / 16 + 1;
-	uint8_t *ptr, *qtr;
-	uint8_t *tx = (uint8_t *)malloc(buf_len);
 
-	if( tx == NULL )
+	dirty = hl_ui_led_find_dirty(handle, tx + 4);
+	if (dirty == 0)
 	{
-		return -1;
+		__atomic_add_fetch(&handle->frames_unchanged, 1, __ATOMIC_RELAXED);
+		// the LEDs already show this frame
+		hl_ui_led_mark_done(handle, 0);
+		return 0;
 	}
-	// start frame
-	for (i = 0; i < 4; i++)
-		*(tx + i) = 0x00;
 
-	// LED data
-	qtr = tx + 4;
+	len = handle->frame_len;
+	if (dirty < handle->number)
+	{
+		// the end frame has to follow the last LED sent, so send a copy
+		len = HL_UI_LED_FRAME_LEN(dirty);
+		memcpy(handle->tx + 4, tx + 4, dirty * 4);
+		memset(handle->tx + 4 + dirty * 4, 0, len - 4 - dirty * 4);
+		tx = handle->tx;
+		__atomic_add_fetch(&handle->frames_truncated, 1, __ATOMIC_RELAXED);
+	}
 
-	for(ptr = handle->pixels, i=0; i<handle->number; i++, ptr += 4, qtr += 4) {
-		qtr[0] = handle->brightness;
-		qtr[1] = ptr[1];
-		qtr[2] = ptr[2];
-		qtr[3] = ptr[3];
+	ret = handle->driver->write(handle, tx, len);
+	if (ret != 0)
+	{
+		// what the LEDs show is unknown now, send the next frame in full
+		handle->wire_valid = 0;
+		__atomic_store_n(&handle->done_complete, 0, __ATOMIC_RELAXED);
+		fprintf(stdout, "[Error] can't write frame to %s driver\n", handle->driver->name);
+		return -2;
 	}
 
-	// end frame
-	for (i = handle->number * 4 + 4; i < buf_len; i++)
+	memcpy(handle->wire, tx + 4, dirty * 4);
+	handle->wire_valid = 1;
+	hl_ui_led_mark_done(handle, dirty == handle->number);
+
+	__atomic_add_fetch(&handle->frames_written, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&handle->bytes_written, len, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+static void *
+hl_ui_led_writer_main(void *data)
+{
+	HL_UI_LED *handle = (HL_UI_LED *)data;
+	uint64_t val;
+	uint32_t slot;
+	int quit;
+
+	while (1)
 	{
-		*(tx + i) = 0x00;
+		if (read(handle->kick_fd, &val, sizeof(val)) < 0 && errno == EINTR)
+			continue;
+
+		// frames queued before the quit request are still written out
+		quit = __atomic_load_n(&handle->quit, __ATOMIC_ACQUIRE);
+
+		while (__atomic_load_n(&handle->pending, __ATOMIC_ACQUIRE) & HL_UI_LED_FRAME_FRESH)
+		{
+			// take the latest queued frame, give our old one back
+			slot = __atomic_exchange_n(&handle->pending, handle->front, __ATOMIC_ACQ_REL);
+			handle->front = HL_UI_LED_FRAME_INDEX(slot);
+
+			hl_ui_led_write_frame(handle, handle->frames[handle->front]);
+
+			val = 1;
+			if (write(handle->done_fd, &val, sizeof(val)) < 0)
+				fprintf(stdout, "[Error] can't signal frame done\n");
+		}
+
+		if (quit)
+			break;
 	}
 
-	ret = peripheral_spi_write(handle->hnd_spi, tx, buf_len);
-	free(tx);
-	if (ret != 0)
+	return NULL;
+}
+
+static int
+hl_ui_led_queue_frame(HL_UI_LED *handle)
+{
+	uint32_t slot;
+	uint64_t val = 1;
+
+	slot = __atomic_exchange_n(&handle->pending, handle->back | HL_UI_LED_FRAME_FRESH, __ATOMIC_ACQ_REL);
+	if (slot & HL_UI_LED_FRAME_FRESH)
+		__atomic_add_fetch(&handle->frames_dropped, 1, __ATOMIC_RELAXED);
+	handle->last = handle->back;
+	hl_ui_led_set_back(handle, HL_UI_LED_FRAME_INDEX(slot));
+
+	if (write(handle->kick_fd, &val, sizeof(val)) < 0)
 	{
-		fprintf(stdout, "[Error] can't send spi message\n");
+		fprintf(stdout, "[Error] can't wake up the writer\n");
 		return -2;
 	}
 
 	return 0;
 }
 
+static int
+hl_ui_led_refresh(HL_UI_LED *handle)
+{
+	int ret;
+	uint8_t *tx;
+
+	// the back frame already holds the LED data in wire format
+	hl_ui_led_sync_back(handle);
+	tx = handle->frames[handle->back];
+
+	if (handle->writer_running)
+		return hl_ui_led_queue_frame(handle);
+
+	ret = hl_ui_led_write_frame(handle, tx);
+
+	handle->last = handle->back;
+	hl_ui_led_set_back(handle, handle->pending);
+	handle->pending = handle->last;
+
+	return ret;
+}
+
+int
+HL_UI_LED_Refresh(HL_UI_LED *handle)
+{
+	if (handle->txn_depth)
+	{
+		handle->txn_dirty = 1;
+		return 0;
+	}
+
+	handle->txn_dirty = 0;
+	return hl_ui_led_refresh(handle);
+}
+
+void
+HL_UI_LED_Begin(HL_UI_LED *handle)
+{
+	handle->txn_depth++;
+}
+
+int
+HL_UI_LED_Commit(HL_UI_LED *handle)
+{
+	if (handle->txn_depth == 0 || --handle->txn_depth > 0)
+		return 1;
+
+	if (!handle->txn_dirty)
+		return 1;
+
+	handle->txn_dirty = 0;
+	return hl_ui_led_refresh(handle);
+}
+
+void
+HL_UI_LED_Get_Stats(HL_UI_LED *handle, uint64_t *frames, uint64_t *bytes, uint64_t *dropped)
+{
+	if (frames)
+		*frames = __atomic_load_n(&handle->frames_written, __ATOMIC_RELAXED);
+	if (bytes)
+		*bytes = __atomic_load_n(&handle->bytes_written, __ATOMIC_RELAXED);
+	if (dropped)
+		*dropped = __atomic_load_n(&handle->frames_dropped, __ATOMIC_RELAXED);
+}
+
+uint64_t
+HL_UI_LED_Get_Done_Time(HL_UI_LED *handle, int *complete)
+{
+	uint64_t nsec = __atomic_load_n(&handle->done_nsec, __ATOMIC_ACQUIRE);
+
+	if (complete)
+		*complete = __atomic_load_n(&handle->done_complete, __ATOMIC_RELAXED);
+
+	return nsec;
+}
+
+void
+HL_UI_LED_Set_Truncate(HL_UI_LED *handle, int enable)
+{
+	handle->truncate = enable ? 1 : 0;
+}
+
+void
+HL_UI_LED_Get_Truncate_Stats(HL_UI_LED *handle, uint64_t *truncated, uint64_t *unchanged)
+{
+	if (truncated)
+		*truncated = __atomic_load_n(&handle->frames_truncated, __ATOMIC_RELAXED);
+	if (unchanged)
+		*unchanged = __atomic_load_n(&handle->frames_unchanged, __ATOMIC_RELAXED);
+}
+
+int
+HL_UI_LED_Start_Writer(HL_UI_LED *handle)
+{
+	if (handle->writer_running)
+		return 0;
+
+	handle->kick_fd = eventfd(0, EFD_CLOEXEC);
+	handle->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (handle->kick_fd < 0 || handle->done_fd < 0)
+	{
+		fprintf(stdout, "[Error] can't create eventfd (%s)\n", strerror(errno));
+		goto error;
+	}
+
+	handle->quit = 0;
+	if (pthread_create(&handle->writer, NULL, hl_ui_led_writer_main, handle) != 0)
+	{
+		fprintf(stdout, "[Error] can't create writer thread\n");
+		goto error;
+	}
+
+	handle->writer_running = 1;
+	return 0;
+
+error:
+	if (handle->kick_fd >= 0)
+		close(handle->kick_fd);
+	if (handle->done_fd >= 0)
+		close(handle->done_fd);
+	handle->kick_fd = -1;
+	handle->done_fd = -1;
+	return -1;
+}
+
+void
+HL_UI_LED_Stop_Writer(HL_UI_LED *handle)
+{
+	uint64_t val = 1;
+
+	if (!handle->writer_running)
+		return;
+
+	__atomic_store_n(&handle->quit, 1, __ATOMIC_RELEASE);
+	if (write(handle->kick_fd, &val, sizeof(val)) < 0)
+		fprintf(stdout, "[Error] can't wake up the writer\n");
+	pthread_join(handle->writer, NULL);
+
+	close(handle->kick_fd);
+	close(handle->done_fd);
+	handle->kick_fd = -1;
+	handle->done_fd = -1;
+	handle->pending = HL_UI_LED_FRAME_INDEX(handle->pending);
+	handle->writer_running = 0;
+}
+
+int
+HL_UI_LED_Get_Done_Fd(HL_UI_LED *handle)
+{
+	return handle->writer_running ? handle->done_fd : -1;
+}
+
 int
 HL_UI_LED_Show(HL_UI_LED *handle)
 {
@@ -223,12 +579,11 @@ HL_UI_LED_Show(HL_UI_LED *handle)
 void
 HL_UI_LED_Close(HL_UI_LED *handle)
 {
+	// whatever was staged is dropped, the LEDs are cleared
+	handle->txn_depth = 0;
 	HL_UI_LED_Clear_All(handle);
-	peripheral_spi_close(handle->hnd_spi);
+	HL_UI_LED_Stop_Writer(handle);
+	handle->driver->close(handle);
 
-	if (handle->pixels) {
-		free(handle->pixels);
-	}
-
-	free(handle);
+	hl_ui_led_free(handle);
 }
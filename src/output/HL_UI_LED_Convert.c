@@ -0,0 +1,173 @@
+/*
+ * Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+#endif
+#define HAVE_NEON 1
+#endif
+
+#include "HL_UI_LED.h"
+
+/*
+ * LED data is [header, B, G, R] per LED, where B/G/R are taken from the same
+ * byte offsets of the source pixel (see B_OFF_SET, G_OFF_SET and R_OFF_SET).
+ * So each LED is the source pixel with its first byte replaced by the header.
+ * On little-endian CPUs: led = (pixel & 0xFFFFFF00) | header.
+ */
+
+typedef void (*convert_func_t)(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t header);
+
+static void
+convert_scalar(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t header)
+{
+	uint32_t i;
+
+	for (i = 0; i < count; i++, src += 4, dst += 4) {
+		dst[0] = header;
+		dst[B_OFF_SET] = src[B_OFF_SET];
+		dst[G_OFF_SET] = src[G_OFF_SET];
+		dst[R_OFF_SET] = src[R_OFF_SET];
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) static void
+convert_sse2(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t header)
+{
+	const __m128i mask = _mm_set1_epi32((int)0xFFFFFF00);
+	const __m128i hdr = _mm_set1_epi32(header);
+	uint32_t i;
+
+	for (i = 0; i + 4 <= count; i += 4, src += 16, dst += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)src);
+
+		v = _mm_or_si128(_mm_and_si128(v, mask), hdr);
+		_mm_storeu_si128((__m128i *)dst, v);
+	}
+
+	convert_scalar(dst, src, count - i, header);
+}
+
+__attribute__((target("avx2"))) static void
+convert_avx2(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t header)
+{
+	const __m256i mask = _mm256_set1_epi32((int)0xFFFFFF00);
+	const __m256i hdr = _mm256_set1_epi32(header);
+	uint32_t i;
+
+	for (i = 0; i + 8 <= count; i += 8, src += 32, dst += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)src);
+
+		v = _mm256_or_si256(_mm256_and_si256(v, mask), hdr);
+		_mm256_storeu_si256((__m256i *)dst, v);
+	}
+
+	convert_scalar(dst, src, count - i, header);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void
+convert_neon(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t header)
+{
+	const uint32x4_t mask = vdupq_n_u32(0xFFFFFF00);
+	const uint32x4_t hdr = vdupq_n_u32(header);
+	uint32_t i;
+
+	for (i = 0; i + 4 <= count; i += 4, src += 16, dst += 16) {
+		uint32x4_t v = vreinterpretq_u32_u8(vld1q_u8(src));
+
+		v = vorrq_u32(vandq_u32(v, mask), hdr);
+		vst1q_u8(dst, vreinterpretq_u8_u32(v));
+	}
+
+	convert_scalar(dst, src, count - i, header);
+}
+#endif
+
+static convert_func_t convert_func = convert_scalar;
+static const char *convert_func_name = "scalar";
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+
+static void
+convert_select(void)
+{
+	const char *env = getenv("HEADLESS_LED_CONVERT");
+
+	/* HEADLESS_LED_CONVERT=scalar forces the reference implementation */
+	if (env && !strcmp(env, "scalar"))
+		return;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		convert_func = convert_avx2;
+		convert_func_name = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		convert_func = convert_sse2;
+		convert_func_name = "sse2";
+	}
+#endif
+#ifdef HAVE_NEON
+#if !defined(__aarch64__)
+	if (!(getauxval(AT_HWCAP) & HWCAP_NEON))
+		return;
+#endif
+	convert_func = convert_neon;
+	convert_func_name = "neon";
+#endif
+#endif
+}
+
+void
+hl_ui_led_convert(uint8_t *dst, const uint8_t *src, uint32_t count, uint8_t header)
+{
+	pthread_once(&convert_once, convert_select);
+
+	convert_func(dst, src, count, header);
+}
+
+const char *
+hl_ui_led_convert_name(void)
+{
+	pthread_once(&convert_once, convert_select);
+
+	return convert_func_name;
+}
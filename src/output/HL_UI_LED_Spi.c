@@ -0,0 +1,85 @@
+/*
+ * Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <peripheral_io.h>
+
+#include "HL_UI_LED.h"
+
+/* a single attempt, the output retries in the background when it fails */
+static int
+hl_ui_led_spi_open(HL_UI_LED *handle, const HL_UI_LED_Param *param)
+{
+	peripheral_spi_h hnd_spi = NULL;
+	int ret;
+
+	if((ret = peripheral_spi_open(param->spi_bus, param->spi_dev, &hnd_spi)) != 0)
+	{
+		printf("spi open failed : 0x%x\n", ret);
+		return -1;
+	}
+
+	printf("spi open success!\n");
+	if((ret = peripheral_spi_set_frequency(hnd_spi, param->bitrate)) != 0)
+	{
+		printf("Frequency Failed : 0x%x\n", ret);
+	}
+	if((ret = peripheral_spi_set_bits_per_word(hnd_spi, 8)) != 0)
+	{
+		printf("BIT_WORD Failed : 0x%x\n", ret);
+	}
+	if((ret = peripheral_spi_set_bit_order(hnd_spi,PERIPHERAL_SPI_BIT_ORDER_MSB)) != 0)
+	{
+		printf("BIT_ORDER Failed : 0x%x\n", ret);
+	}
+	if((ret = peripheral_spi_set_mode(hnd_spi,PERIPHERAL_SPI_MODE_1)) != 0)
+	{
+		printf("SPI Mode Failed : 0x%x\n", ret);
+	}
+
+	handle->driver_data = hnd_spi;
+	return 0;
+}
+
+static int
+hl_ui_led_spi_write(HL_UI_LED *handle, const uint8_t *data, uint32_t len)
+{
+	// peripheral_spi_write() does not modify the buffer
+	return peripheral_spi_write((peripheral_spi_h)handle->driver_data, (uint8_t *)data, len);
+}
+
+static void
+hl_ui_led_spi_close(HL_UI_LED *handle)
+{
+	peripheral_spi_close((peripheral_spi_h)handle->driver_data);
+	handle->driver_data = NULL;
+}
+
+const HL_UI_LED_Driver HL_UI_LED_Driver_Spi =
+{
+	"spi",
+	hl_ui_led_spi_open,
+	hl_ui_led_spi_write,
+	hl_ui_led_spi_close,
+};
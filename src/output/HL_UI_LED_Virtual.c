@@ -0,0 +1,175 @@
+/*
+ * Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "HL_UI_LED.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+
+#define HL_UI_LED_VIRTUAL_SLOTS 16
+#define NSEC_PER_SEC 1000000000LL
+
+/*
+ * Hardware-free driver: frames go to a memory ring instead of the SPI bus,
+ * so the whole output path can be regression-tested and benchmarked.
+ */
+typedef struct {
+	int fd;
+	HL_UI_LED_Virtual_Ring *ring;
+	size_t size;
+	size_t slot_size;
+	uint32_t bitrate;	/* 0 unless throttled */
+} hl_ui_led_virtual_t;
+
+static int
+hl_ui_led_virtual_open(HL_UI_LED *handle, const HL_UI_LED_Param *param)
+{
+	hl_ui_led_virtual_t *virt;
+	uint32_t slots;
+
+	virt = (hl_ui_led_virtual_t *)calloc(1, sizeof(hl_ui_led_virtual_t));
+	if (virt == NULL)
+		return -1;
+
+	slots = param->slots ? param->slots : HL_UI_LED_VIRTUAL_SLOTS;
+	virt->slot_size = HL_UI_LED_VIRTUAL_SLOT_SIZE(handle->frame_len);
+	virt->size = sizeof(HL_UI_LED_Virtual_Ring) + virt->slot_size * slots;
+	if (param->throttle)
+		virt->bitrate = param->bitrate;
+
+	if (param->path)
+		virt->fd = open(param->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	else
+		virt->fd = (int)syscall(SYS_memfd_create, "hl_ui_led_virtual", MFD_CLOEXEC);
+	if (virt->fd < 0)
+	{
+		fprintf(stdout, "[Error] can't create virtual ring %s (%s)\n",
+				param->path ? param->path : "memfd", strerror(errno));
+		free(virt);
+		return -1;
+	}
+
+	if (ftruncate(virt->fd, (off_t)virt->size) < 0)
+		goto error;
+
+	virt->ring = (HL_UI_LED_Virtual_Ring *)mmap(NULL, virt->size, PROT_READ | PROT_WRITE,
+											MAP_SHARED, virt->fd, 0);
+	if (virt->ring == MAP_FAILED)
+		goto error;
+
+	virt->ring->number = handle->number;
+	virt->ring->frame_len = handle->frame_len;
+	virt->ring->slots = slots;
+	virt->ring->sequence = 0;
+	__atomic_store_n(&virt->ring->magic, HL_UI_LED_VIRTUAL_MAGIC, __ATOMIC_RELEASE);
+
+	printf("virtual led ring: %s, %u slots of %u bytes\n",
+			param->path ? param->path : "memfd", slots, handle->frame_len);
+
+	handle->driver_data = virt;
+	return 0;
+
+error:
+	fprintf(stdout, "[Error] can't map virtual ring (%s)\n", strerror(errno));
+	close(virt->fd);
+	free(virt);
+	return -1;
+}
+
+static int
+hl_ui_led_virtual_write(HL_UI_LED *handle, const uint8_t *data, uint32_t len)
+{
+	hl_ui_led_virtual_t *virt = (hl_ui_led_virtual_t *)handle->driver_data;
+	HL_UI_LED_Virtual_Ring *ring = virt->ring;
+	HL_UI_LED_Virtual_Slot *slot;
+	struct timespec deadline;
+	uint64_t seq;
+	int64_t nsec;
+
+	if (len > ring->frame_len)
+		return -1;
+
+	if (virt->bitrate)
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+	seq = ring->sequence + 1;
+	slot = (HL_UI_LED_Virtual_Slot *)((uint8_t *)(ring + 1) + ((seq - 1) % ring->slots) * virt->slot_size);
+
+	// a release fence would not keep the copy from moving above this store
+	__atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	memcpy(slot + 1, data, len);
+	slot->len = len;
+	__atomic_store_n(&slot->sequence, seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->sequence, seq, __ATOMIC_RELEASE);
+
+	// take as long as the transfer would on the bus
+	if (virt->bitrate)
+	{
+		nsec = deadline.tv_nsec + (int64_t)len * 8 * NSEC_PER_SEC / virt->bitrate;
+		deadline.tv_sec += nsec / NSEC_PER_SEC;
+		deadline.tv_nsec = nsec % NSEC_PER_SEC;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+			;
+	}
+
+	return 0;
+}
+
+static void
+hl_ui_led_virtual_close(HL_UI_LED *handle)
+{
+	hl_ui_led_virtual_t *virt = (hl_ui_led_virtual_t *)handle->driver_data;
+
+	munmap(virt->ring, virt->size);
+	close(virt->fd);
+	free(virt);
+	handle->driver_data = NULL;
+}
+
+int
+HL_UI_LED_Virtual_Get_Fd(HL_UI_LED *handle)
+{
+	if (handle->driver != &HL_UI_LED_Driver_Virtual)
+		return -1;
+
+	return ((hl_ui_led_virtual_t *)handle->driver_data)->fd;
+}
+
+const HL_UI_LED_Driver HL_UI_LED_Driver_Virtual =
+{
+	"virtual",
+	hl_ui_led_virtual_open,
+	hl_ui_led_virtual_write,
+	hl_ui_led_virtual_close,
+};
@@ -25,6 +25,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include <tbm_bufmgr.h>
 #include <wayland-tbm-server.h>
@@ -32,43 +36,340 @@
 #include "HL_UI_LED.h"
 #include "output_internal.h"
 
+/*
+ * The boot animation is a sequence of frames encoded once at start, either
+ * read from boot_anim_file or generated. The file lists the colours of the
+ * LEDs (0xRRGGBB, in LED order) frame after frame, separated by spaces,
+ * commas or new lines, '#' starts a comment. A tick only copies the next
+ * encoded frame into each strip and writes it. Ticks come from a timerfd
+ * armed on absolute deadlines, so a busy loop delays a frame but never
+ * shifts the ones after it.
+ *
+ * headless_output_boot() runs the same timer on a thread of its own before
+ * the compositor exists. The output then takes the timer over as is, so
+ * the animation goes on with the same frames and deadlines. If the thread
+ * is still opening the strips by then, the output does not wait for it:
+ * the animation is dropped and the retry path adopts the strips later.
+ */
+#define NSEC_PER_SEC	1000000000LL
+#define NSEC_PER_MSEC	1000000LL
+#define BOOT_ANI_MAX_BYTES	(4 * 1024 * 1024)
+
 typedef struct {
-	HL_UI_LED *led;
+	led_output_t *output;
 
+	int fd;
 	struct wl_event_source *source;
-	uint32_t serial;
-	int index;
+	int64_t start;
+	int64_t interval;
+	uint64_t tick;
+	uint64_t missed;
+	pepper_bool_t shown;
+
+	//For playing before the event loop runs
+	pthread_t thread;
+	pepper_bool_t thread_running;
+	int quit_fd;
+	led_output_opener_t *opener;	/* the strips the thread opens */
+
+	uint8_t *frames;	/* encoded LED data of every frame */
+	uint32_t frame_size;
+	uint32_t num_frames;
 
 	pepper_event_listener_t *surface_add_listener;
 } boot_ani_t;
 
-#define ANI_INTERVAL	40	//20ms
+/* generated sequence: each colour wipes over the previous one */
+static const uint32_t boot_ani_colors[] =
+{
+	0xFF0000, 0xFF8000, 0xFFFF00, 0x00FF00, 0x0000FF, 0x8000FF,
+};
+#define BOOT_ANI_NUM_COLORS (sizeof(boot_ani_colors) / sizeof(boot_ani_colors[0]))
+
+static void
+boot_ani_set_pixel(uint8_t *pixel, uint32_t rgb)
+{
+	pixel[0] = 0;
+	pixel[R_OFF_SET] = (uint8_t)(rgb >> 16);
+	pixel[G_OFF_SET] = (uint8_t)(rgb >> 8);
+	pixel[B_OFF_SET] = (uint8_t)rgb;
+}
+
+static pepper_bool_t
+boot_ani_generate(boot_ani_t *ani, uint32_t num_led)
+{
+	uint32_t step = 1, per_color, c, f, i, lit;
+	uint8_t *frame;
+
+	/* light more LEDs per frame rather than keep too many frames */
+	while ((size_t)BOOT_ANI_NUM_COLORS * ((num_led + step - 1) / step) * ani->frame_size > BOOT_ANI_MAX_BYTES)
+		step *= 2;
+	per_color = (num_led + step - 1) / step;
+
+	ani->num_frames = BOOT_ANI_NUM_COLORS * per_color;
+	ani->frames = (uint8_t *)malloc((size_t)ani->num_frames * ani->frame_size);
+	PEPPER_CHECK(ani->frames, return PEPPER_FALSE, "failed to alloc boot-animation frames\n");
+
+	frame = ani->frames;
+	for (c = 0; c < BOOT_ANI_NUM_COLORS; c++) {
+		for (f = 0; f < per_color; f++, frame += ani->frame_size) {
+			lit = (f + 1) * step;
+			for (i = 0; i < num_led; i++)
+				boot_ani_set_pixel(frame + i * 4, i < lit ? boot_ani_colors[c] :
+								boot_ani_colors[(c + BOOT_ANI_NUM_COLORS - 1) % BOOT_ANI_NUM_COLORS]);
+		}
+	}
+
+	return PEPPER_TRUE;
+}
 
 static int
-boot_ani_timer_cb(void *data)
+boot_ani_read_token(FILE *fp, char *tok, int size)
+{
+	int ch, len = 0;
+
+	while ((ch = getc(fp)) != EOF) {
+		if (ch == '#') {
+			while ((ch = getc(fp)) != EOF && ch != '\n')
+				;
+		}
+
+		if (ch == EOF || ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == ',') {
+			if (len)
+				break;
+			continue;
+		}
+
+		if (len < size - 1)
+			tok[len++] = (char)ch;
+	}
+
+	tok[len] = '\0';
+	return len;
+}
+
+static pepper_bool_t
+boot_ani_load_file(boot_ani_t *ani, const char *path, uint32_t num_led)
+{
+	FILE *fp;
+	char tok[32], *end;
+	uint8_t *frames = NULL, *tmp;
+	size_t count = 0, alloc = 0;
+	unsigned long v;
+
+	fp = fopen(path, "r");
+	PEPPER_CHECK(fp, return PEPPER_FALSE, "failed to open boot-animation file %s\n", path);
+
+	while (boot_ani_read_token(fp, tok, sizeof(tok))) {
+		v = strtoul(tok, &end, 16);
+		PEPPER_CHECK(*end == '\0' && v <= 0xFFFFFF, goto error,
+					"invalid colour '%s' in %s\n", tok, path);
+
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : num_led;
+			PEPPER_CHECK(alloc * 4 <= BOOT_ANI_MAX_BYTES, goto error,
+						"%s is larger than %d bytes of frames\n", path, BOOT_ANI_MAX_BYTES);
+			tmp = (uint8_t *)realloc(frames, alloc * 4);
+			PEPPER_CHECK(tmp, goto error, "failed to alloc boot-animation frames\n");
+			frames = tmp;
+		}
+
+		boot_ani_set_pixel(frames + count * 4, (uint32_t)v);
+		count++;
+	}
+
+	PEPPER_CHECK(count && count % num_led == 0, goto error,
+				"%s has %zu colours, not whole frames of %u LEDs\n", path, count, num_led);
+
+	fclose(fp);
+	ani->frames = frames;
+	ani->num_frames = (uint32_t)(count / num_led);
+	return PEPPER_TRUE;
+
+error:
+	free(frames);
+	fclose(fp);
+	return PEPPER_FALSE;
+}
+
+/* turn the pixels of a strip into LED data once, a tick is then a plain copy */
+static void
+boot_ani_encode_strip(boot_ani_t *ani, led_output_strip_t *strip)
+{
+	uint8_t *frame;
+	uint32_t f;
+
+	/* only the header byte changes, so strips can be encoded again */
+	for (f = 0, frame = ani->frames; f < ani->num_frames; f++, frame += ani->frame_size)
+		hl_ui_led_convert(frame + strip->offset * 4, frame + strip->offset * 4,
+						(uint32_t)strip->num_led, HL_UI_LED_Get_Header(strip->ui_led));
+}
+
+/* ms since exec, from the start time of the process (clock ticks since boot) */
+static long long
+boot_ani_get_exec_elapsed(void)
+{
+	FILE *fp;
+	char buf[1024], *p;
+	unsigned long long start = 0;
+	struct timespec ts;
+	size_t len;
+	long hz;
+	int i;
+
+	fp = fopen("/proc/self/stat", "r");
+	if (!fp)
+		return -1;
+	len = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	buf[len] = '\0';
+
+	/* starttime is the 20th field after the command name */
+	p = strrchr(buf, ')');
+	for (i = 0; p && i < 20; i++)
+		p = strchr(p + 1, ' ');
+	hz = sysconf(_SC_CLK_TCK);
+	if (!p || hz <= 0 || sscanf(p, " %llu", &start) != 1)
+		return -1;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - (long long)(start * 1000 / hz);
+}
+
+static void
+boot_ani_show(boot_ani_t *ani)
+{
+	led_output_t *output = ani->output;
+	led_output_strip_t *strip;
+	const uint8_t *frame;
+	int i;
+
+	frame = ani->frames + (size_t)(ani->tick % ani->num_frames) * ani->frame_size;
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (!strip->ui_led)
+			continue;
+
+		HL_UI_LED_Begin(strip->ui_led);
+		HL_UI_LED_Load_Encoded(strip->ui_led, frame + strip->offset * 4);
+		HL_UI_LED_Commit(strip->ui_led);
+	}
+
+	if (!ani->shown) {
+		ani->shown = PEPPER_TRUE;
+		PEPPER_TRACE("[OUTPUT] first boot-animation frame %lld ms after exec\n",
+					boot_ani_get_exec_elapsed());
+	}
+}
+
+static void
+boot_ani_tick(boot_ani_t *ani)
+{
+	uint64_t expirations;
+
+	if (read(ani->fd, &expirations, sizeof(expirations)) < 0 || !expirations)
+		return;
+
+	/* frames whose deadline passed while the loop was busy are skipped */
+	ani->missed += expirations - 1;
+	ani->tick += expirations;
+	boot_ani_show(ani);
+}
+
+static int
+boot_ani_timer_cb(int fd, uint32_t mask, void *data)
+{
+	boot_ani_tick((boot_ani_t *)data);
+	return 0;
+}
+
+static void *
+boot_ani_thread_main(void *data)
+{
+	led_output_opener_t *opener = (led_output_opener_t *)data;
+	boot_ani_t *ani;
+	struct pollfd fds[2];
+
+	/* a slow device only holds this thread back. Once the output stopped
+	 * waiting, 'ani' is gone and the output adopts the strips itself. */
+	if (!led_output_opener_run(opener))
+		return NULL;
+
+	ani = (boot_ani_t *)opener->data;
+
+	if (!led_output_adopt_strips(ani->output, ani->opener))
+		return NULL;
+
+	boot_ani_show(ani);
+
+	fds[0].fd = ani->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = ani->quit_fd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(fds, 2, -1) < 0)
+			continue;
+
+		/* the timer is left armed for the output to take over */
+		if (fds[1].revents)
+			break;
+
+		if (fds[0].revents)
+			boot_ani_tick(ani);
+	}
+
+	return NULL;
+}
+
+static void
+boot_ani_stop_thread(boot_ani_t *ani)
 {
-	boot_ani_t *ani = (boot_ani_t *)data;
-	uint8_t r,g,b;
-	uint32_t color;
+	uint64_t val = 1;
+
+	if (!ani->thread_running)
+		return;
 
-	if (ani->index == 0) {
-		r = (uint8_t)(rand()%0xFF);
-		g = (uint8_t)(rand()%0xFF);
-		b = (uint8_t)(rand()%0xFF);
-		HL_UI_LED_Set_Pixel_RGB(ani->led, ani->index, r, g, b);
+	/* never wait for an open that may hang, the thread is left to finish it */
+	if (led_output_opener_abandon(ani->output, ani->opener)) {
+		pthread_detach(ani->thread);
+		ani->opener = NULL;
 	} else {
-		color = HL_UI_LED_Get_Pixel_4byte(ani->led, ani->index - 1);
-		HL_UI_LED_Set_Pixel_4byte(ani->led, ani->index, color);
+		if (write(ani->quit_fd, &val, sizeof(val)) < 0)
+			PEPPER_ERROR("failed to wake up the boot-animation thread\n");
+		pthread_join(ani->thread, NULL);
 	}
 
-	HL_UI_LED_Refresh(ani->led);
+	close(ani->quit_fd);
+	ani->quit_fd = -1;
+	ani->thread_running = PEPPER_FALSE;
+}
 
-	ani->serial++;
-	ani->index = (ani->serial)%12;
+static pepper_bool_t
+boot_ani_start_timer(boot_ani_t *ani)
+{
+	struct itimerspec its;
+	struct timespec ts;
+	int64_t first;
 
-	wl_event_source_timer_update(ani->source, ANI_INTERVAL);
+	ani->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	PEPPER_CHECK(ani->fd >= 0, return PEPPER_FALSE, "failed to timerfd_create()\n");
 
-	return 1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ani->start = (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+	first = ani->start + ani->interval;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = first / NSEC_PER_SEC;
+	its.it_value.tv_nsec = first % NSEC_PER_SEC;
+	its.it_interval.tv_sec = ani->interval / NSEC_PER_SEC;
+	its.it_interval.tv_nsec = ani->interval % NSEC_PER_SEC;
+
+	PEPPER_CHECK(timerfd_settime(ani->fd, TFD_TIMER_ABSTIME, &its, NULL) == 0,
+				return PEPPER_FALSE, "failed to timerfd_settime()\n");
+
+	return PEPPER_TRUE;
 }
 
 static void
@@ -81,60 +382,177 @@ boot_ani_surface_add_cb(pepper_event_listener_t *listener,
 	boot_ani_stop(output);
 }
 
-void boot_ani_start(led_output_t *output)
+static void
+boot_ani_destroy(boot_ani_t *ani)
 {
-	struct wl_event_loop *loop;
-	boot_ani_t *ani;
-	int ret;
+	boot_ani_stop_thread(ani);
 
-	PEPPER_TRACE("[OUTPUT] start boot-animation\n");
+	if (ani->source)
+		wl_event_source_remove(ani->source);
+	if (ani->surface_add_listener)
+		pepper_event_listener_remove(ani->surface_add_listener);
+	if (ani->fd >= 0)
+		close(ani->fd);
+	if (ani->opener)
+		led_output_opener_destroy(ani->opener);
 
-	loop = wl_display_get_event_loop(pepper_compositor_get_display(output->compositor));
-	PEPPER_CHECK(loop, return, "failed to wl_display_get_event_loop()\n");
+	free(ani->frames);
+	free(ani);
+}
+
+static boot_ani_t *
+boot_ani_create(led_output_t *output)
+{
+	boot_ani_t *ani;
+	pepper_bool_t ret = PEPPER_FALSE;
+	int i;
 
 	ani = (boot_ani_t *)calloc(sizeof(boot_ani_t), 1);
-	PEPPER_CHECK(ani, return, "failed to alloc\n");
+	PEPPER_CHECK(ani, return NULL, "failed to alloc\n");
+
+	ani->output = output;
+	ani->fd = -1;
+	ani->quit_fd = -1;
+	ani->interval = (int64_t)output->config.boot_anim_interval * NSEC_PER_MSEC;
+	ani->frame_size = (uint32_t)output->num_led * 4;
+
+	if (output->config.boot_anim_file[0])
+		ret = boot_ani_load_file(ani, output->config.boot_anim_file, (uint32_t)output->num_led);
+	if (!ret)
+		ret = boot_ani_generate(ani, (uint32_t)output->num_led);
+	PEPPER_CHECK(ret, goto err, "failed to prepare boot-animation frames\n");
+
+	for (i = 0; i < output->num_strips; i++) {
+		if (output->strips[i].ui_led)
+			boot_ani_encode_strip(ani, &output->strips[i]);
+	}
 
-	ani->source = wl_event_loop_add_timer(loop, boot_ani_timer_cb, ani);
-	PEPPER_CHECK(ani, goto err, "failed to wl_event_loop_add_timer()\n");
+	PEPPER_CHECK(boot_ani_start_timer(ani), goto err, "failed to start boot-animation timer\n");
+
+	PEPPER_TRACE("[OUTPUT] boot-animation: %u frames every %d ms\n", ani->num_frames,
+				output->config.boot_anim_interval);
+	return ani;
+
+err:
+	boot_ani_destroy(ani);
+	return NULL;
+}
+
+/* play on the compositor's event loop from now on */
+static pepper_bool_t
+boot_ani_add_to_loop(boot_ani_t *ani)
+{
+	led_output_t *output = ani->output;
+	struct wl_event_loop *loop;
+
+	loop = wl_display_get_event_loop(pepper_compositor_get_display(output->compositor));
+	PEPPER_CHECK(loop, return PEPPER_FALSE, "failed to wl_display_get_event_loop()\n");
 
-	ret = wl_event_source_timer_update(ani->source, ANI_INTERVAL);
-	PEPPER_CHECK(!ret, goto err, "failed to wl_event_source_timer_update\n");
+	ani->source = wl_event_loop_add_fd(loop, ani->fd, WL_EVENT_READABLE, boot_ani_timer_cb, ani);
+	PEPPER_CHECK(ani->source, return PEPPER_FALSE, "failed to wl_event_loop_add_fd()\n");
 
 	ani->surface_add_listener = pepper_object_add_event_listener((pepper_object_t *)output->compositor,
 																		PEPPER_EVENT_COMPOSITOR_SURFACE_ADD,
 																		0, boot_ani_surface_add_cb, output);
+	return PEPPER_TRUE;
+}
+
+void boot_ani_start(led_output_t *output)
+{
+	boot_ani_t *ani;
+
+	PEPPER_TRACE("[OUTPUT] start boot-animation\n");
+
+	ani = boot_ani_create(output);
+	if (!ani)
+		return;
+
+	if (!boot_ani_add_to_loop(ani)) {
+		boot_ani_destroy(ani);
+		return;
+	}
+
+	/* first frame right away, the timer shows the next ones */
+	boot_ani_show(ani);
 
-	ani->led = output->ui_led;
 	output->boot_ani = ani;
+}
+
+void boot_ani_start_thread(led_output_t *output)
+{
+	boot_ani_t *ani;
+
+	PEPPER_TRACE("[OUTPUT] start boot-animation thread\n");
+
+	ani = boot_ani_create(output);
+	if (!ani)
+		return;
+
+	ani->quit_fd = eventfd(0, EFD_CLOEXEC);
+	PEPPER_CHECK(ani->quit_fd >= 0, goto err, "failed to create eventfd\n");
+
+	ani->opener = led_output_opener_create(output);
+	PEPPER_CHECK(ani->opener, goto err, "failed to create the strip opener\n");
+	ani->opener->data = ani;
+
+	/* the thread encodes the strips it opens through output->boot_ani */
+	output->boot_ani = ani;
+	PEPPER_CHECK(pthread_create(&ani->thread, NULL, boot_ani_thread_main, ani->opener) == 0, goto err,
+				"failed to create boot-animation thread\n");
+	ani->thread_running = PEPPER_TRUE;
 	return;
+
 err:
-	if (ani) {
-		if (ani->source)
-			wl_event_source_remove(ani->source);
+	output->boot_ani = NULL;
+	boot_ani_destroy(ani);
+}
 
-		free(ani);
-	}
-	return;
+void boot_ani_add_strip(led_output_t *output, led_output_strip_t *strip)
+{
+	if (output->boot_ani)
+		boot_ani_encode_strip((boot_ani_t *)output->boot_ani, strip);
+}
+
+void boot_ani_attach(led_output_t *output)
+{
+	boot_ani_t *ani = (boot_ani_t *)output->boot_ani;
+
+	if (!ani || !ani->thread_running)
+		return;
+
+	/* the LEDs belong to the caller's thread again after this */
+	boot_ani_stop_thread(ani);
+
+	PEPPER_TRACE("[OUTPUT] boot-animation taken over at tick %llu\n",
+				(unsigned long long)ani->tick);
+
+	/* nothing was opened, strips come back later without the animation */
+	if (!ani->shown || !boot_ani_add_to_loop(ani))
+		boot_ani_stop(output);
 }
 
 void boot_ani_stop(led_output_t *output)
 {
 	boot_ani_t *ani;
+	int i;
 
 	if (!output->boot_ani) return;
 
 	ani = (boot_ani_t *)output->boot_ani;
+	boot_ani_stop_thread(ani);
 
-	HL_UI_LED_Clear_All(ani->led);
-	wl_event_source_remove(ani->source);
+	PEPPER_TRACE("[OUTPUT] stop boot-animation (ticks:%llu, missed:%llu)\n",
+				(unsigned long long)ani->tick, (unsigned long long)ani->missed);
 
-	if(ani->surface_add_listener) {
-		pepper_event_listener_remove(ani->surface_add_listener);
-		ani->surface_add_listener = NULL;
+	for (i = 0; i < output->num_strips; i++) {
+		if (output->strips[i].ui_led)
+			HL_UI_LED_Clear_All(output->strips[i].ui_led);
 	}
 
-	free(ani);
+	/* LEDs were changed behind the output, present the next frame again */
+	output->presented.valid = PEPPER_FALSE;
+
+	boot_ani_destroy(ani);
 
 	output->boot_ani = NULL;
 	return;
@@ -0,0 +1,215 @@
+/*
+* Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pepper.h>
+#include <headless_server.h>
+#include "HL_UI_LED.h"
+#include "output_internal.h"
+
+/*
+ * Keyframe animations are uploaded once and then rendered by the output on
+ * its refresh clock, so the client does not commit a buffer per frame.
+ * Keyframe i lasts keyframes[i].duration_ms, during which the LEDs go from
+ * keyframe i to the next one (the first after the last) with its easing.
+ * Keyframes are remapped to LED order at upload, so a tick is one blend.
+ */
+#define ANIM_ONE	(1 << 16)
+#define NSEC_PER_MSEC	1000000LL
+#define ANIM_MAX_DURATION	(24 * 3600 * 1000)	//ms of one keyframe
+
+typedef struct {
+	uint8_t *pixels;	/* num_led + 1 pixels, LED order */
+	int64_t duration;	/* ns */
+	headless_output_easing_t easing;
+} led_output_keyframe_t;
+
+struct led_output_anim {
+	led_output_keyframe_t *keyframes;
+	int count;
+	int repeat;	/* passes to play, 0 forever */
+	int64_t period;	/* ns of one pass */
+	int64_t length;	/* ns of all the passes, 0 forever */
+	int64_t start;
+	uint32_t num_led;
+	uint8_t *out;
+	uint64_t ticks;
+};
+
+static uint32_t
+led_output_anim_ease(headless_output_easing_t easing, uint32_t t)
+{
+	uint64_t r;
+
+	switch (easing) {
+	case HEADLESS_OUTPUT_EASING_STEP:
+		return 0;
+	case HEADLESS_OUTPUT_EASING_IN:
+		return (uint32_t)(((uint64_t)t * t) >> 16);
+	case HEADLESS_OUTPUT_EASING_OUT:
+		r = ANIM_ONE - t;
+		return (uint32_t)(ANIM_ONE - ((r * r) >> 16));
+	case HEADLESS_OUTPUT_EASING_IN_OUT:
+		if (t < ANIM_ONE / 2)
+			return (uint32_t)((2 * (uint64_t)t * t) >> 16);
+		r = ANIM_ONE - t;
+		return (uint32_t)(ANIM_ONE - ((2 * r * r) >> 16));
+	case HEADLESS_OUTPUT_EASING_LINEAR:
+	default:
+		return t;
+	}
+}
+
+void
+led_output_anim_destroy(led_output_anim_t *anim)
+{
+	int i;
+
+	if (anim->keyframes) {
+		for (i = 0; i < anim->count; i++)
+			free(anim->keyframes[i].pixels);
+		free(anim->keyframes);
+	}
+
+	free(anim->out);
+	free(anim);
+}
+
+led_output_anim_t *
+led_output_anim_create(led_output_t *output, const headless_output_keyframe_t *keyframes,
+						int count, int repeat, int64_t start)
+{
+	led_output_anim_t *anim;
+	uint32_t i, num_pixels, size;
+	const uint8_t *src;
+	int k;
+
+	PEPPER_CHECK(keyframes && count > 0 && count <= HEADLESS_OUTPUT_MAX_KEYFRAMES && repeat >= 0, return NULL,
+				"[OUTPUT] invalid keyframes (count:%d, repeat:%d)\n", count, repeat);
+
+	anim = (led_output_anim_t *)calloc(1, sizeof(led_output_anim_t));
+	PEPPER_CHECK(anim, return NULL, "[OUTPUT] fail to alloc animation\n");
+
+	anim->num_led = (uint32_t)output->num_led;
+	anim->repeat = repeat;
+	anim->start = start;
+	size = (anim->num_led + 1) * 4;
+	num_pixels = (uint32_t)(output->layout_w * output->layout_h);
+
+	anim->out = (uint8_t *)calloc(1, size);
+	anim->keyframes = (led_output_keyframe_t *)calloc(count, sizeof(led_output_keyframe_t));
+	PEPPER_CHECK(anim->out && anim->keyframes, goto error, "[OUTPUT] fail to alloc animation\n");
+	anim->count = count;
+
+	for (k = 0; k < count; k++) {
+		PEPPER_CHECK(keyframes[k].pixels, goto error, "[OUTPUT] keyframe %d has no pixels\n", k);
+
+		anim->keyframes[k].pixels = (uint8_t *)calloc(1, size);
+		PEPPER_CHECK(anim->keyframes[k].pixels, goto error, "[OUTPUT] fail to alloc keyframe\n");
+
+		src = (const uint8_t *)keyframes[k].pixels;
+		for (i = 0; i < num_pixels; i++)
+			memcpy(anim->keyframes[k].pixels + output->remap[i] * 4, src + i * 4, 4);
+
+		/* a day at most, so that the period of a pass fits even with the most keyframes */
+		anim->keyframes[k].duration = (int64_t)(keyframes[k].duration_ms > ANIM_MAX_DURATION ?
+								ANIM_MAX_DURATION : keyframes[k].duration_ms) * NSEC_PER_MSEC;
+		anim->keyframes[k].easing = keyframes[k].easing;
+		anim->period += anim->keyframes[k].duration;
+	}
+
+	PEPPER_CHECK(anim->period > 0, goto error, "[OUTPUT] keyframes have no duration\n");
+
+	/* as many passes as fit in int64 ns, which is centuries anyway */
+	if (repeat) {
+		if (repeat > INT64_MAX / anim->period)
+			anim->repeat = (int)(INT64_MAX / anim->period);
+		anim->length = anim->period * anim->repeat;
+	}
+
+	return anim;
+
+error:
+	led_output_anim_destroy(anim);
+	return NULL;
+}
+
+/* LED pixels at 'now', 'done' is set once the last pass has ended */
+const uint8_t *
+led_output_anim_render(led_output_anim_t *anim, int64_t now, pepper_bool_t *done)
+{
+	led_output_keyframe_t *from, *to;
+	int64_t elapsed, duration, progress;
+	uint32_t t, i, len;
+	int k;
+
+	elapsed = now - anim->start;
+	if (elapsed < 0)
+		elapsed = 0;
+
+	*done = PEPPER_FALSE;
+	if (anim->length && elapsed >= anim->length) {
+		/* the last segment ends on the first keyframe */
+		*done = PEPPER_TRUE;
+		return anim->keyframes[0].pixels;
+	}
+
+	elapsed %= anim->period;
+	for (k = 0; elapsed >= anim->keyframes[k].duration; k++)
+		elapsed -= anim->keyframes[k].duration;
+
+	from = &anim->keyframes[k];
+	to = &anim->keyframes[(k + 1) % anim->count];
+
+	/* 16.16 position in the segment, scaled down so that the shift cannot overflow */
+	duration = from->duration;
+	if (elapsed > duration)
+		elapsed = duration;
+	while (duration >= ((int64_t)1 << 46)) {
+		duration >>= 1;
+		elapsed >>= 1;
+	}
+	progress = (elapsed << 16) / duration;
+	t = (uint32_t)(progress > 0xFFFF ? 0xFFFF : progress);
+	t = led_output_anim_ease(from->easing, t);
+
+	anim->ticks++;
+	if (t == 0)
+		return from->pixels;
+
+	len = anim->num_led * 4;
+	for (i = 0; i < len; i++)
+		anim->out[i] = (uint8_t)(from->pixels[i] +
+					(((int32_t)to->pixels[i] - from->pixels[i]) * (int32_t)t >> 16));
+
+	return anim->out;
+}
+
+uint64_t
+led_output_anim_get_ticks(led_output_anim_t *anim)
+{
+	return anim->ticks;
+}
@@ -0,0 +1,330 @@
+/*
+* Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <pepper.h>
+#include "HL_UI_LED.h"
+#include "output_internal.h"
+
+/*
+ * The LED output is configured from a "key=value" file (HEADLESS_LED_CONFIG,
+ * LED_CONFIG_PATH by default) and then from the environment, e.g.
+ *
+ *	# /etc/headless/led.conf
+ *	num_led=300
+ *	spi_bus=0
+ *	spi_dev=1
+ *	bitrate=8000000
+ *
+ * Several strips on separate SPI devices are listed as "bus.dev:leds" and
+ * are driven in parallel, e.g. strips=0.0:150,1.0:150 (num_led is then the
+ * sum of the strips).
+ *
+ * LED panels are described with layout=linear|serpentine_rows|
+ * serpentine_cols|file, layout_width, layout_height, layout_rotate and
+ * layout_file (see output_layout.c).
+ *
+ * The boot animation plays boot_anim_file (see boot_anim.c), one frame
+ * every boot_anim_interval ms.
+ *
+ * driver=virtual writes the frames to a memory ring instead of the SPI bus
+ * (see HL_UI_LED_Virtual_Ring), in virtual_path or in an anonymous memfd.
+ */
+#define LED_CONFIG_PATH	"/etc/headless/led.conf"
+#define MAX_NUM_LED	65536
+
+typedef struct {
+	const char *env;
+	const char *key;
+} led_config_env_t;
+
+static const char *layout_names[] =
+{
+	[LED_LAYOUT_LINEAR] = "linear",
+	[LED_LAYOUT_SERPENTINE_ROWS] = "serpentine_rows",
+	[LED_LAYOUT_SERPENTINE_COLS] = "serpentine_cols",
+	[LED_LAYOUT_FILE] = "file",
+};
+
+static const led_config_env_t config_envs[] =
+{
+	{ "HEADLESS_LED_NUM", "num_led" },
+	{ "HEADLESS_LED_DRIVER", "driver" },
+	{ "HEADLESS_LED_VIRTUAL_PATH", "virtual_path" },
+	{ "HEADLESS_LED_VIRTUAL_SLOTS", "virtual_slots" },
+	{ "HEADLESS_LED_VIRTUAL_THROTTLE", "virtual_throttle" },
+	{ "HEADLESS_LED_SPI_BUS", "spi_bus" },
+	{ "HEADLESS_LED_SPI_DEV", "spi_dev" },
+	{ "HEADLESS_LED_BITRATE", "bitrate" },
+	{ "HEADLESS_LED_ASYNC_WRITE", "async_write" },
+	{ "HEADLESS_LED_TRUNCATE", "truncate_frames" },
+	{ "HEADLESS_LED_STRIPS", "strips" },
+	{ "HEADLESS_LED_LAYOUT", "layout" },
+	{ "HEADLESS_LED_LAYOUT_WIDTH", "layout_width" },
+	{ "HEADLESS_LED_LAYOUT_HEIGHT", "layout_height" },
+	{ "HEADLESS_LED_LAYOUT_ROTATE", "layout_rotate" },
+	{ "HEADLESS_LED_LAYOUT_FILE", "layout_file" },
+	{ "HEADLESS_LED_BOOT_ANIM_FILE", "boot_anim_file" },
+	{ "HEADLESS_LED_BOOT_ANIM_INTERVAL", "boot_anim_interval" },
+};
+
+static pepper_bool_t
+led_config_parse_int(const char *value, long min, long max, long *out)
+{
+	char *end = NULL;
+	long v;
+
+	v = strtol(value, &end, 0);
+	if (!end || end == value || *end != '\0' || v < min || v > max)
+		return PEPPER_FALSE;
+
+	*out = v;
+	return PEPPER_TRUE;
+}
+
+static pepper_bool_t
+led_config_parse_strips(led_output_config_t *config, const char *value)
+{
+	led_output_strip_config_t strips[LED_OUTPUT_MAX_STRIPS];
+	int num = 0, bus, dev, leds, len;
+	const char *p = value;
+
+	while (*p) {
+		if (num == LED_OUTPUT_MAX_STRIPS)
+			return PEPPER_FALSE;
+
+		len = 0;
+		if (sscanf(p, "%d.%d:%d%n", &bus, &dev, &leds, &len) != 3 || !len)
+			return PEPPER_FALSE;
+		if (bus < 0 || bus > 255 || dev < 0 || dev > 255 || leds < 1 || leds > MAX_NUM_LED)
+			return PEPPER_FALSE;
+
+		strips[num].spi_bus = bus;
+		strips[num].spi_dev = dev;
+		strips[num].num_led = leds;
+		num++;
+
+		p += len;
+		if (*p == ',')
+			p++;
+		else if (*p != '\0')
+			return PEPPER_FALSE;
+	}
+
+	if (!num)
+		return PEPPER_FALSE;
+
+	memcpy(config->strips, strips, sizeof(strips[0]) * num);
+	config->num_strips = num;
+	return PEPPER_TRUE;
+}
+
+static void
+led_config_set(led_output_config_t *config, const char *key, const char *value)
+{
+	unsigned int i;
+	long v;
+
+	if (!strcmp(key, "num_led")) {
+		PEPPER_CHECK(led_config_parse_int(value, 1, MAX_NUM_LED, &v), return,
+					"[OUTPUT] invalid num_led '%s'\n", value);
+		config->num_led = (int)v;
+	} else if (!strcmp(key, "driver")) {
+		PEPPER_CHECK(HL_UI_LED_Find_Driver(value), return,
+					"[OUTPUT] unknown driver '%s'\n", value);
+		snprintf(config->driver, sizeof(config->driver), "%s", value);
+	} else if (!strcmp(key, "virtual_path")) {
+		PEPPER_CHECK(strlen(value) < sizeof(config->virtual_path), return,
+					"[OUTPUT] too long virtual_path '%s'\n", value);
+		snprintf(config->virtual_path, sizeof(config->virtual_path), "%s", value);
+	} else if (!strcmp(key, "virtual_slots")) {
+		PEPPER_CHECK(led_config_parse_int(value, 1, 4096, &v), return,
+					"[OUTPUT] invalid virtual_slots '%s'\n", value);
+		config->virtual_slots = (int)v;
+	} else if (!strcmp(key, "virtual_throttle")) {
+		PEPPER_CHECK(led_config_parse_int(value, 0, 1, &v), return,
+					"[OUTPUT] invalid virtual_throttle '%s'\n", value);
+		config->virtual_throttle = v ? PEPPER_TRUE : PEPPER_FALSE;
+	} else if (!strcmp(key, "spi_bus")) {
+		PEPPER_CHECK(led_config_parse_int(value, 0, 255, &v), return,
+					"[OUTPUT] invalid spi_bus '%s'\n", value);
+		config->spi_bus = (int)v;
+	} else if (!strcmp(key, "spi_dev")) {
+		PEPPER_CHECK(led_config_parse_int(value, 0, 255, &v), return,
+					"[OUTPUT] invalid spi_dev '%s'\n", value);
+		config->spi_dev = (int)v;
+	} else if (!strcmp(key, "bitrate")) {
+		PEPPER_CHECK(led_config_parse_int(value, 1, 100000000, &v), return,
+					"[OUTPUT] invalid bitrate '%s'\n", value);
+		config->bitrate = (uint32_t)v;
+	} else if (!strcmp(key, "async_write")) {
+		PEPPER_CHECK(led_config_parse_int(value, 0, 1, &v), return,
+					"[OUTPUT] invalid async_write '%s'\n", value);
+		config->async_write = v ? PEPPER_TRUE : PEPPER_FALSE;
+	} else if (!strcmp(key, "truncate_frames")) {
+		PEPPER_CHECK(led_config_parse_int(value, 0, 1, &v), return,
+					"[OUTPUT] invalid truncate_frames '%s'\n", value);
+		config->truncate_frames = v ? PEPPER_TRUE : PEPPER_FALSE;
+	} else if (!strcmp(key, "layout")) {
+		for (i = 0; i < sizeof(layout_names) / sizeof(layout_names[0]); i++) {
+			if (!strcmp(value, layout_names[i]))
+				break;
+		}
+		PEPPER_CHECK(i < sizeof(layout_names) / sizeof(layout_names[0]), return,
+					"[OUTPUT] invalid layout '%s'\n", value);
+		config->layout = (led_output_layout_type_t)i;
+	} else if (!strcmp(key, "layout_width")) {
+		PEPPER_CHECK(led_config_parse_int(value, 1, MAX_NUM_LED, &v), return,
+					"[OUTPUT] invalid layout_width '%s'\n", value);
+		config->layout_width = (int)v;
+	} else if (!strcmp(key, "layout_height")) {
+		PEPPER_CHECK(led_config_parse_int(value, 1, MAX_NUM_LED, &v), return,
+					"[OUTPUT] invalid layout_height '%s'\n", value);
+		config->layout_height = (int)v;
+	} else if (!strcmp(key, "layout_rotate")) {
+		PEPPER_CHECK(led_config_parse_int(value, 0, 270, &v) && v % 90 == 0, return,
+					"[OUTPUT] invalid layout_rotate '%s'\n", value);
+		config->layout_rotate = (int)v;
+	} else if (!strcmp(key, "layout_file")) {
+		PEPPER_CHECK(strlen(value) < sizeof(config->layout_file), return,
+					"[OUTPUT] too long layout_file '%s'\n", value);
+		snprintf(config->layout_file, sizeof(config->layout_file), "%s", value);
+	} else if (!strcmp(key, "boot_anim_file")) {
+		PEPPER_CHECK(strlen(value) < sizeof(config->boot_anim_file), return,
+					"[OUTPUT] too long boot_anim_file '%s'\n", value);
+		snprintf(config->boot_anim_file, sizeof(config->boot_anim_file), "%s", value);
+	} else if (!strcmp(key, "boot_anim_interval")) {
+		PEPPER_CHECK(led_config_parse_int(value, 1, 10000, &v), return,
+					"[OUTPUT] invalid boot_anim_interval '%s'\n", value);
+		config->boot_anim_interval = (int)v;
+	} else if (!strcmp(key, "strips")) {
+		PEPPER_CHECK(led_config_parse_strips(config, value), return,
+					"[OUTPUT] invalid strips '%s'\n", value);
+	} else {
+		PEPPER_ERROR("[OUTPUT] unknown config key '%s'\n", key);
+	}
+}
+
+static char *
+led_config_strip(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+	*end = '\0';
+
+	return str;
+}
+
+static void
+led_config_load_file(led_output_config_t *config, const char *path)
+{
+	FILE *fp;
+	char line[256];
+	char *key, *value, *sep;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return;
+
+	PEPPER_TRACE("[OUTPUT] load LED config from %s\n", path);
+
+	while (fgets(line, sizeof(line), fp)) {
+		key = led_config_strip(line);
+		if (*key == '\0' || *key == '#')
+			continue;
+
+		sep = strchr(key, '=');
+		if (!sep) {
+			PEPPER_ERROR("[OUTPUT] invalid config line '%s'\n", key);
+			continue;
+		}
+
+		*sep = '\0';
+		value = led_config_strip(sep + 1);
+		key = led_config_strip(key);
+
+		led_config_set(config, key, value);
+	}
+
+	fclose(fp);
+}
+
+void
+led_output_config_load(led_output_config_t *config)
+{
+	const char *path, *value;
+	unsigned int i;
+
+	config->num_led = NUM_LED;
+	snprintf(config->driver, sizeof(config->driver), "%s", HL_UI_LED_Driver_Spi.name);
+	config->virtual_path[0] = '\0';
+	config->virtual_slots = 0;
+	config->virtual_throttle = PEPPER_FALSE;
+	config->spi_bus = HL_UI_LED_SPI_BUS;
+	config->spi_dev = HL_UI_LED_SPI_DEV;
+	config->bitrate = BITRATE;
+	config->async_write = PEPPER_FALSE;
+	config->truncate_frames = PEPPER_TRUE;
+	config->layout = LED_LAYOUT_LINEAR;
+	config->layout_width = 0;
+	config->layout_height = 0;
+	config->layout_rotate = 0;
+	config->layout_file[0] = '\0';
+	config->boot_anim_file[0] = '\0';
+	config->boot_anim_interval = BOOT_ANI_INTERVAL;
+	config->num_strips = 0;
+
+	path = getenv("HEADLESS_LED_CONFIG");
+	led_config_load_file(config, path ? path : LED_CONFIG_PATH);
+
+	for (i = 0; i < sizeof(config_envs) / sizeof(config_envs[0]); i++) {
+		value = getenv(config_envs[i].env);
+		if (value)
+			led_config_set(config, config_envs[i].key, value);
+	}
+
+	if (!config->num_strips) {
+		config->num_strips = 1;
+		config->strips[0].spi_bus = config->spi_bus;
+		config->strips[0].spi_dev = config->spi_dev;
+		config->strips[0].num_led = config->num_led;
+	} else {
+		config->num_led = 0;
+		for (i = 0; i < (unsigned int)config->num_strips; i++)
+			config->num_led += config->strips[i].num_led;
+	}
+
+	PEPPER_TRACE("[OUTPUT] LED config: num_led:%d driver:%s spi:%d.%d bitrate:%u async_write:%d strips:%d\n",
+				config->num_led, config->driver, config->spi_bus, config->spi_dev,
+				config->bitrate, config->async_write, config->num_strips);
+}
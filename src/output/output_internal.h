@@ -25,27 +25,227 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <pepper-output-backend.h>
+#include <pepper-inotify.h>
+#include <headless_server.h>
+#include <tbm_surface.h>
 
 #define NUM_LED 12
+#define LED_OUTPUT_REFRESH 60000	//mHz
+#define LED_OUTPUT_BRIGHTNESS 1	//0-31
+#define BOOT_ANI_INTERVAL 40	//ms
+#define LED_OUTPUT_RETRY_MIN 100	//ms
+#define LED_OUTPUT_RETRY_MAX 5000	//ms
+
+#define LED_CONFIG_STR_MAX 256
+#define LED_OUTPUT_MAX_STRIPS 8
+#define LED_OUTPUT_BUFFER_CACHE 4
+#define LED_OUTPUT_SAMPLER_CACHE 4
+
+typedef struct {
+	int spi_bus;
+	int spi_dev;
+	int num_led;
+} led_output_strip_config_t;
+
+typedef enum {
+	LED_LAYOUT_LINEAR,
+	LED_LAYOUT_SERPENTINE_ROWS,
+	LED_LAYOUT_SERPENTINE_COLS,
+	LED_LAYOUT_FILE,
+} led_output_layout_type_t;
+
+typedef struct {
+	int num_led;
+	char driver[LED_CONFIG_STR_MAX];
+	char virtual_path[LED_CONFIG_STR_MAX];	/* empty: anonymous memfd */
+	int virtual_slots;
+	pepper_bool_t virtual_throttle;
+	int spi_bus;
+	int spi_dev;
+	uint32_t bitrate;
+	pepper_bool_t async_write;
+	pepper_bool_t truncate_frames;
+
+	/* panel wiring, 0 width/height means num_led x 1 */
+	led_output_layout_type_t layout;
+	int layout_width;
+	int layout_height;
+	int layout_rotate;
+	char layout_file[LED_CONFIG_STR_MAX];
+
+	/* boot animation, generated when there is no file */
+	char boot_anim_file[LED_CONFIG_STR_MAX];
+	int boot_anim_interval;	/* ms */
+
+	/* the output is split across the strips in this order */
+	int num_strips;
+	led_output_strip_config_t strips[LED_OUTPUT_MAX_STRIPS];
+} led_output_config_t;
+
+typedef struct {
+	void *output;
+	HL_UI_LED *ui_led;
+	int offset;	/* index of the first LED of the strip in the output */
+	int num_led;
+
+	//For asynchronous SPI writer
+	struct wl_event_source *write_done;
+	pepper_bool_t write_pending;
+} led_output_strip_t;
+
+/* box sampling of a client buffer down to the LED layout, see output_sample.c */
+typedef struct {
+	int src_w, src_h;
+	int dst_w, dst_h;
+	uint32_t *spans;	/* storage of the four tables below */
+	uint32_t *x_start, *x_end;
+	uint32_t *y_start, *y_end;
+	uint32_t *area;	/* per LED, source pixels in its box */
+	uint32_t *acc;	/* per source column and byte */
+	const uint32_t *remap;	/* LED index of each layout pixel, owned by the output */
+	uint64_t last_used;
+} led_output_sampler_t;
+
+typedef struct led_output_anim led_output_anim_t;
+
+/* strips opened by the boot-animation thread. If the output stops waiting
+ * for them, its retry path adopts them once the thread is done. */
+typedef struct {
+	pthread_mutex_t lock;
+	led_output_config_t config;	/* a copy, the output can be gone first */
+	int num_strips;
+	HL_UI_LED *leds[LED_OUTPUT_MAX_STRIPS];
+	pepper_bool_t done;
+	pepper_bool_t abandoned;	/* the output adopts the LEDs */
+	pepper_bool_t orphaned;	/* nobody does, the thread closes them */
+	void *data;	/* the thread's, only valid while not abandoned */
+} led_output_opener_t;
+
+/* imported client buffer, kept until the buffer is destroyed. It is only
+ * mapped while it is sampled, the client owns it again once released. */
+typedef struct {
+	pepper_buffer_t *buffer;
+	tbm_surface_h tbm_surface;
+	tbm_surface_info_s info;
+	pepper_bool_t mapped;
+	pepper_bool_t sampled;	/* sampled before, later samples are cache hits */
+	int width, height;
+	pepper_event_listener_t *destroy_listener;
+	uint64_t last_used;
+} led_output_buffer_t;
 
 typedef struct {
 	pepper_compositor_t *compositor;
 	pepper_output_t   *output;
 	pepper_plane_t    *plane;
 
+	led_output_config_t config;
 	int num_led;
-	HL_UI_LED *ui_led;
+	int num_strips;
+	led_output_strip_t strips[LED_OUTPUT_MAX_STRIPS];
 
 	struct wayland_tbm_server *tbm_server;
 	struct wl_event_source *frame_done;
+	pepper_bool_t frame_pending;
+
+	//For refresh clock
+	int refresh;
+	int refresh_fd;
+	struct wl_event_source *refresh_source;
+	pepper_bool_t vblank_pending;
+	int64_t vblank_nsec;
+
+	//Strips still transmitting the current frame
+	int writes_pending;
+
+	//For presentation feedback, a frame is shown when its last transfer ends
+	int64_t latch_nsec;
+	int latch_complete;	/* strips that sent their whole frame */
+	pepper_bool_t latch_partial;	/* a strip truncated, skipped or lost its frame */
+	int64_t present_nsec;
+	uint64_t present_seq;
+	uint64_t present_hw;	/* frames timed by their SPI transfers */
+	struct wl_global *presentation;
+	struct wl_list feedback_list;	/* sent with the next finished frame */
 
 	pepper_view_t *top_view;
 
+	//For skipping unchanged frames
+	struct {
+		pepper_bool_t valid;
+		pepper_view_t *view;
+		pepper_surface_t *surface;
+		uint64_t serial;	/* of the captured frame */
+	} presented;
+	uint64_t capture_serial;
+
+	//LED layout, client buffers are sampled down to layout_w x layout_h
+	int layout_w;
+	int layout_h;
+	uint32_t *remap;
+	led_output_sampler_t samplers[LED_OUTPUT_SAMPLER_CACHE];	/* per source size */
+	uint64_t sampler_clock;
+	uint64_t frames_presented;
+	uint64_t frames_skipped;
+
+	//For reusing buffer imports and mappings
+	led_output_buffer_t buffers[LED_OUTPUT_BUFFER_CACHE];
+	uint64_t buffer_clock;
+	uint64_t buffer_hits;
+	uint64_t buffer_misses;
+
+	//For reopening strips whose device is not ready (yet)
+	struct wl_event_source *retry_timer;
+	int retry_delay;	/* ms, doubles up to LED_OUTPUT_RETRY_MAX */
+	pepper_inotify_t *inotify;
+	uint64_t strips_attached;
+	uint64_t strips_detached;
+	led_output_opener_t *opener;	/* left behind by the boot-animation thread */
+
+	//For keyframe animations played on the refresh clock
+	led_output_anim_t *anim;
+
 	//For booting animation
 	void *boot_ani;
 }led_output_t;
 
+PEPPER_API void led_output_config_load(led_output_config_t *config);
+
+PEPPER_API uint32_t *led_output_layout_build(led_output_config_t *config, int *width, int *height);
+
+PEPPER_API pepper_bool_t led_output_sampler_prepare(led_output_sampler_t *sampler,
+												int src_w, int src_h, int dst_w, int dst_h);
+PEPPER_API void led_output_sampler_run(led_output_sampler_t *sampler, uint8_t *dst,
+									const uint8_t *src, int stride);
+PEPPER_API void led_output_sampler_fini(led_output_sampler_t *sampler);
+
+PEPPER_API led_output_anim_t *led_output_anim_create(led_output_t *output,
+							const headless_output_keyframe_t *keyframes,
+							int count, int repeat, int64_t start);
+PEPPER_API void led_output_anim_destroy(led_output_anim_t *anim);
+PEPPER_API const uint8_t *led_output_anim_render(led_output_anim_t *anim, int64_t now, pepper_bool_t *done);
+PEPPER_API uint64_t led_output_anim_get_ticks(led_output_anim_t *anim);
+
+PEPPER_API pepper_bool_t led_output_presentation_init(led_output_t *output);
+PEPPER_API void led_output_presentation_fini(led_output_t *output);
+PEPPER_API void led_output_presentation_take(led_output_t *output, pepper_surface_t *surface,
+											pepper_bool_t shown);
+PEPPER_API void led_output_presentation_present(led_output_t *output, int64_t nsec,
+												pepper_bool_t hw_completion);
+
+PEPPER_API HL_UI_LED *led_output_get_led(led_output_t *output, int index, uint32_t *led_index);
+PEPPER_API pepper_bool_t led_output_open_strips(led_output_t *output);
+PEPPER_API led_output_opener_t *led_output_opener_create(led_output_t *output);
+PEPPER_API pepper_bool_t led_output_opener_run(led_output_opener_t *opener);
+PEPPER_API pepper_bool_t led_output_opener_abandon(led_output_t *output, led_output_opener_t *opener);
+PEPPER_API void led_output_opener_destroy(led_output_opener_t *opener);
+PEPPER_API pepper_bool_t led_output_adopt_strips(led_output_t *output, led_output_opener_t *opener);
+
 PEPPER_API void boot_ani_start(led_output_t *output);
+PEPPER_API void boot_ani_start_thread(led_output_t *output);
+PEPPER_API void boot_ani_attach(led_output_t *output);
+PEPPER_API void boot_ani_add_strip(led_output_t *output, led_output_strip_t *strip);
 PEPPER_API void boot_ani_stop(led_output_t *output);
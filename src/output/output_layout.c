@@ -0,0 +1,172 @@
+/*
+* Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pepper.h>
+#include "HL_UI_LED.h"
+#include "output_internal.h"
+
+/*
+ * A layout maps each pixel of the client image to an LED index. The panel
+ * is layout_width x layout_height LEDs wired in one of these orders:
+ *
+ *	linear:          row by row, left to right
+ *	serpentine_rows: row by row, every other row right to left
+ *	serpentine_cols: column by column, every other column bottom to top
+ *	file:            layout_file lists the LED index of each panel position,
+ *	                 row by row, -1 where there is no LED
+ *
+ * layout_rotate (0, 90, 180, 270) is the clockwise rotation of the client
+ * image on the panel. The result is a flat table, remap[y * w + x] = LED,
+ * built once at startup. Positions without an LED map to num_led, a spare
+ * pixel of the frame store that is never sent.
+ */
+
+static int *
+led_layout_load_file(const char *path, int count)
+{
+	FILE *fp;
+	char line[1024], *p, *end;
+	int *map, n = 0;
+	long v;
+
+	fp = fopen(path, "r");
+	PEPPER_CHECK(fp, return NULL, "[OUTPUT] fail to open layout file %s\n", path);
+
+	map = (int *)calloc(count, sizeof(int));
+	PEPPER_CHECK(map, goto error, "[OUTPUT] fail to alloc layout map\n");
+
+	while (n < count && fgets(line, sizeof(line), fp)) {
+		for (p = line; n < count; p = end) {
+			while (*p == ' ' || *p == '\t' || *p == ',')
+				p++;
+			if (*p == '#' || *p == '\n' || *p == '\0')
+				break;
+
+			v = strtol(p, &end, 0);
+			if (end == p) {
+				PEPPER_ERROR("[OUTPUT] invalid layout entry '%s' in %s\n", p, path);
+				goto error;
+			}
+			map[n++] = (int)v;
+		}
+	}
+
+	if (n < count) {
+		PEPPER_ERROR("[OUTPUT] %s has %d of %d layout entries\n", path, n, count);
+		goto error;
+	}
+
+	fclose(fp);
+	return map;
+
+error:
+	free(map);
+	fclose(fp);
+	return NULL;
+}
+
+static int
+led_layout_panel_index(led_output_config_t *config, const int *file_map, int x, int y, int w, int h)
+{
+	switch (config->layout) {
+	case LED_LAYOUT_SERPENTINE_ROWS:
+		return y * w + ((y & 1) ? w - 1 - x : x);
+	case LED_LAYOUT_SERPENTINE_COLS:
+		return x * h + ((x & 1) ? h - 1 - y : y);
+	case LED_LAYOUT_FILE:
+		return file_map[y * w + x];
+	case LED_LAYOUT_LINEAR:
+	default:
+		return y * w + x;
+	}
+}
+
+uint32_t *
+led_output_layout_build(led_output_config_t *config, int *width, int *height)
+{
+	uint32_t *remap;
+	int *file_map = NULL;
+	int w, h, cw, ch, cx, cy, x, y, led;
+
+	w = config->layout_width ? config->layout_width : config->num_led;
+	h = config->layout_height ? config->layout_height : (config->num_led + w - 1) / w;
+
+	if (config->layout == LED_LAYOUT_FILE) {
+		file_map = led_layout_load_file(config->layout_file, w * h);
+		if (!file_map) {
+			PEPPER_ERROR("[OUTPUT] fall back to the linear layout\n");
+			config->layout = LED_LAYOUT_LINEAR;
+		}
+	}
+
+	if (config->layout_rotate == 90 || config->layout_rotate == 270) {
+		cw = h;
+		ch = w;
+	} else {
+		cw = w;
+		ch = h;
+	}
+
+	remap = (uint32_t *)calloc((size_t)cw * ch, sizeof(uint32_t));
+	PEPPER_CHECK(remap, goto out, "[OUTPUT] fail to alloc layout table\n");
+
+	for (cy = 0; cy < ch; cy++) {
+		for (cx = 0; cx < cw; cx++) {
+			switch (config->layout_rotate) {
+			case 90:
+				x = w - 1 - cy;
+				y = cx;
+				break;
+			case 180:
+				x = w - 1 - cx;
+				y = h - 1 - cy;
+				break;
+			case 270:
+				x = cy;
+				y = h - 1 - cx;
+				break;
+			default:
+				x = cx;
+				y = cy;
+				break;
+			}
+
+			led = led_layout_panel_index(config, file_map, x, y, w, h);
+			if (led < 0 || led >= config->num_led)
+				led = config->num_led;
+			remap[cy * cw + cx] = (uint32_t)led;
+		}
+	}
+
+	*width = cw;
+	*height = ch;
+	PEPPER_TRACE("[OUTPUT] LED layout %dx%d (panel %dx%d, type:%d, rotate:%d)\n",
+				cw, ch, w, h, config->layout, config->layout_rotate);
+
+out:
+	free(file_map);
+	return remap;
+}
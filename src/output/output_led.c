@@ -25,26 +25,107 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/timerfd.h>
 
 #include <tbm_bufmgr.h>
+#include <tbm_surface_internal.h>
 #include <wayland-tbm-server.h>
 #include <pepper-output-backend.h>
 #include "HL_UI_LED.h"
 #include "output_internal.h"
 
+#define NSEC_PER_SEC	1000000000LL
+
 static const int KEY_OUTPUT;
+static const int KEY_FRAME;
+
+/* pixels captured from a surface, its buffer is released right after */
+typedef struct {
+	unsigned char *pixels;
+	uint32_t count;
+	uint64_t serial;	/* changes with each capture, 0 if none yet */
+} led_output_frame_t;
+
+static void led_output_capture(led_output_t *output, pepper_surface_t *surface);
+static led_output_buffer_t *led_output_get_buffer(led_output_t *output, pepper_buffer_t *buf);
+static void led_output_release_buffer(led_output_buffer_t *entry);
 static void led_output_add_frame_done(led_output_t *output);
+static void led_output_finish_frame(led_output_t *output);
+static void led_output_latch_reset(led_output_t *output);
 static void led_output_update(led_output_t *output);
+static pepper_bool_t led_output_schedule_vblank(led_output_t *output);
+static void led_output_opener_orphan(led_output_t *output);
 
 static void
 led_output_destroy(void *data)
 {
 	led_output_t *output = (led_output_t *)data;
+	led_output_strip_t *strip;
+	int i;
+
 	PEPPER_TRACE("Output Destroy %p base %p\n", output, output->output);
 
-	if (output->ui_led) {
-		HL_UI_LED_Close(output->ui_led);
-		output->ui_led = NULL;
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (strip->write_done) {
+			wl_event_source_remove(strip->write_done);
+			strip->write_done = NULL;
+		}
+	}
+
+	if (output->frame_done) {
+		wl_event_source_remove(output->frame_done);
+		output->frame_done = NULL;
+	}
+
+	if (output->refresh_source) {
+		wl_event_source_remove(output->refresh_source);
+		output->refresh_source = NULL;
+	}
+
+	if (output->refresh_fd >= 0) {
+		close(output->refresh_fd);
+		output->refresh_fd = -1;
+	}
+
+	led_output_presentation_fini(output);
+
+	if (output->retry_timer) {
+		wl_event_source_remove(output->retry_timer);
+		output->retry_timer = NULL;
+	}
+
+	if (output->inotify) {
+		pepper_inotify_del(output->inotify, "/dev");
+		pepper_inotify_destroy(output->inotify);
+		output->inotify = NULL;
+	}
+
+	led_output_opener_orphan(output);
+
+	for (i = 0; i < LED_OUTPUT_BUFFER_CACHE; i++)
+		led_output_release_buffer(&output->buffers[i]);
+
+	for (i = 0; i < LED_OUTPUT_SAMPLER_CACHE; i++)
+		led_output_sampler_fini(&output->samplers[i]);
+
+	if (output->anim) {
+		led_output_anim_destroy(output->anim);
+		output->anim = NULL;
+	}
+
+	if (output->remap) {
+		free(output->remap);
+		output->remap = NULL;
+	}
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (strip->ui_led) {
+			HL_UI_LED_Close(strip->ui_led);
+			strip->ui_led = NULL;
+		}
 	}
 
 	if (output->tbm_server) {
@@ -88,9 +169,9 @@ led_output_get_mode(void *o, int index, pepper_output_mode_t *mode)
 		return;
 
 	mode->flags = WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED;
-	mode->w = output->num_led;
-	mode->h = output->num_led;
-	mode->refresh = 60000;
+	mode->w = output->layout_w;
+	mode->h = output->layout_h;
+	mode->refresh = output->refresh;
 }
 
 static pepper_bool_t
@@ -147,6 +228,10 @@ led_output_repaint(void *o, const pepper_list_t *plane_list)
 		pepper_plane_clear_damage_region(plane);
 	}
 
+	/* keyframe animation frames sent since the last frame do not time this one */
+	if (!output->frame_pending)
+		led_output_latch_reset(output);
+
 	led_output_update(output);
 	led_output_add_frame_done(output);
 }
@@ -154,15 +239,39 @@ led_output_repaint(void *o, const pepper_list_t *plane_list)
 static void
 led_output_attach_surface(void *o, pepper_surface_t *surface, int *w, int *h)
 {
-	*w = 10;
-	*h = 10;
-	PEPPER_TRACE("[OUTPUT] attach surface:%p\n", surface);
+	led_output_t *output = (led_output_t *)o;
+	pepper_buffer_t *buf;
+	struct wl_shm_buffer *shm_buffer;
+	led_output_buffer_t *entry;
+
+	/* the buffer is sampled down to the LEDs, whatever its size */
+	*w = output->layout_w;
+	*h = output->layout_h;
+
+	buf = pepper_surface_get_buffer(surface);
+	if (buf) {
+		shm_buffer = wl_shm_buffer_get(pepper_buffer_get_resource(buf));
+		if (shm_buffer) {
+			*w = wl_shm_buffer_get_width(shm_buffer);
+			*h = wl_shm_buffer_get_height(shm_buffer);
+		} else if ((entry = led_output_get_buffer(output, buf))) {
+			*w = entry->width;
+			*h = entry->height;
+		}
+	}
+
+	PEPPER_TRACE("[OUTPUT] attach surface:%p (%dx%d)\n", surface, *w, *h);
 }
 
 static void
 led_output_flush_surface_damage(void *o, pepper_surface_t *surface, pepper_bool_t *keep_buffer)
 {
-	*keep_buffer = PEPPER_TRUE;
+	led_output_t *output = (led_output_t *)o;
+
+	/* copy what the LEDs need now, the client can reuse its buffer right away */
+	led_output_capture(output, surface);
+
+	*keep_buffer = PEPPER_FALSE;
 	PEPPER_TRACE("[OUTPUT] flush_surface_damage surface:%p\n", surface);
 }
 
@@ -184,178 +293,1341 @@ struct pepper_output_backend led_output_backend = {
 	led_output_flush_surface_damage,
 };
 
+static pepper_bool_t
+led_output_has_led(led_output_t *output)
+{
+	int i;
+
+	for (i = 0; i < output->num_strips; i++) {
+		if (output->strips[i].ui_led)
+			return PEPPER_TRUE;
+	}
+
+	return PEPPER_FALSE;
+}
+
+HL_UI_LED *
+led_output_get_led(led_output_t *output, int index, uint32_t *led_index)
+{
+	led_output_strip_t *strip;
+	int i;
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (index >= strip->offset && index < strip->offset + strip->num_led) {
+			*led_index = (uint32_t)(index - strip->offset);
+			return strip->ui_led;
+		}
+	}
+
+	return NULL;
+}
+
+/* the frame shows once every strip finished its transfer */
+static void
+led_output_latch(led_output_t *output, led_output_strip_t *strip)
+{
+	int complete = 0;
+	int64_t done = (int64_t)HL_UI_LED_Get_Done_Time(strip->ui_led, &complete);
+
+	if (done > output->latch_nsec)
+		output->latch_nsec = done;
+
+	/* a truncated or unsent frame has no transfer end to report */
+	if (complete)
+		output->latch_complete++;
+	else
+		output->latch_partial = PEPPER_TRUE;
+}
+
+static void
+led_output_latch_reset(led_output_t *output)
+{
+	output->latch_nsec = 0;
+	output->latch_complete = 0;
+	output->latch_partial = PEPPER_FALSE;
+}
+
 static void
-led_output_update_led(led_output_t *output, unsigned char *data)
+led_output_update_led(led_output_t *output, const unsigned char *data, uint32_t count)
 {
+	led_output_strip_t *strip;
 	int i;
-	uint8_t *ptr = (uint8_t *)data;
 
-	if (data == NULL) {
+	if (data == NULL)
 		PEPPER_TRACE("[OUTPUT] update LED to empty\n");
-		HL_UI_LED_Clear_All(output->ui_led);
-		return;
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (!strip->ui_led)
+			continue;
+
+		/* LEDs past the end of the buffer keep their colours */
+		if (data != NULL && count <= (uint32_t)strip->offset)
+			continue;
+
+		/* one transfer per strip, whatever the update consists of */
+		HL_UI_LED_Begin(strip->ui_led);
+		if (data == NULL) {
+			HL_UI_LED_Clear_All(strip->ui_led);
+		} else {
+			/* convert straight from the client buffer into the SPI frame */
+			HL_UI_LED_Set_Pixels_4byte(strip->ui_led, data + strip->offset * 4,
+									count - strip->offset);
+		}
+
+		if (HL_UI_LED_Commit(strip->ui_led) != 0)
+			continue;
+
+		/* strips are written in parallel, the frame is done after the last one */
+		if (strip->write_done && !strip->write_pending) {
+			strip->write_pending = PEPPER_TRUE;
+			output->writes_pending++;
+		} else if (!strip->write_done) {
+			led_output_latch(output, strip);
+		}
 	}
+}
+
+static pepper_bool_t
+led_output_is_presented(led_output_t *output, pepper_view_t *view,
+						pepper_surface_t *surface, uint64_t serial)
+{
+	if (!output->presented.valid)
+		return PEPPER_FALSE;
+
+	return (output->presented.view == view &&
+			output->presented.surface == surface &&
+			output->presented.serial == serial);
+}
+
+static void
+led_output_set_presented(led_output_t *output, pepper_view_t *view,
+						pepper_surface_t *surface, uint64_t serial)
+{
+	output->presented.view = view;
+	output->presented.surface = surface;
+	output->presented.serial = serial;
+	output->presented.valid = PEPPER_TRUE;
+	output->frames_presented++;
+}
+
+static void
+led_output_release_buffer(led_output_buffer_t *entry)
+{
+	if (entry->destroy_listener)
+		pepper_event_listener_remove(entry->destroy_listener);
 
-	for(i=0; i<output->num_led; i++) {
-		HL_UI_LED_Set_Pixel_RGB(output->ui_led, i, ptr[R_OFF_SET], ptr[G_OFF_SET], ptr[B_OFF_SET]);
-		ptr += 4;
+	if (entry->tbm_surface) {
+		if (entry->mapped)
+			tbm_surface_unmap(entry->tbm_surface);
+		tbm_surface_internal_unref(entry->tbm_surface);
 	}
 
-	HL_UI_LED_Refresh(output->ui_led);
+	memset(entry, 0, sizeof(*entry));
 }
 
 static void
-led_output_update(led_output_t *output)
+led_output_cb_cached_buffer_destroy(pepper_event_listener_t *listener,
+										pepper_object_t *object,
+										uint32_t id, void *info, void *data)
 {
-	pepper_buffer_t *buf;
-	pepper_surface_t *surface;
+	led_output_buffer_t *entry = (led_output_buffer_t *)data;
+
+	entry->destroy_listener = NULL;
+	led_output_release_buffer(entry);
+}
+
+/* clients cycle through a few buffers, import each of them once */
+static led_output_buffer_t *
+led_output_get_buffer(led_output_t *output, pepper_buffer_t *buf)
+{
+	led_output_buffer_t *entry = NULL;
 	struct wl_resource *buf_res;
 	tbm_surface_h tbm_surface;
-	tbm_surface_info_s info;
-	int ret;
+	int i;
 
-	if (!output->top_view) {
-		if (!output->ui_led)
-			PEPPER_TRACE("[UPDATE LED] Empty Display\n");
-		else
-			led_output_update_led(output, NULL);
+	for (i = 0; i < LED_OUTPUT_BUFFER_CACHE; i++) {
+		if (output->buffers[i].buffer == buf) {
+			entry = &output->buffers[i];
+			entry->last_used = ++output->buffer_clock;
+			return entry;
+		}
 
-		return;
+		/* reuse a free entry, or else the least recently used one */
+		if (!entry || (entry->buffer && (!output->buffers[i].buffer ||
+				output->buffers[i].last_used < entry->last_used)))
+			entry = &output->buffers[i];
 	}
 
-	surface = pepper_view_get_surface(output->top_view);
-	PEPPER_CHECK(surface, return, "fail to get a surafce from a view(%p)\n", output->top_view);
-
-	buf = pepper_surface_get_buffer(surface);
-	PEPPER_CHECK(buf, return, "fail to get a pepper_buffer from a surface(%p)\n", surface);
+	led_output_release_buffer(entry);
 
 	buf_res = pepper_buffer_get_resource(buf);
 	tbm_surface = wayland_tbm_server_get_surface(NULL, buf_res);
-	PEPPER_CHECK(tbm_surface, return, "fail to get a tbm_surface from a pepper_buffer(%p)\n", buf);
+	PEPPER_CHECK(tbm_surface, return NULL, "fail to get a tbm_surface from a pepper_buffer(%p)\n", buf);
+
+	tbm_surface_internal_ref(tbm_surface);
+	entry->tbm_surface = tbm_surface;
+	entry->width = tbm_surface_get_width(tbm_surface);
+	entry->height = tbm_surface_get_height(tbm_surface);
+	entry->buffer = buf;
+	entry->last_used = ++output->buffer_clock;
+	entry->destroy_listener =
+		pepper_object_add_event_listener((pepper_object_t *)buf,
+										PEPPER_EVENT_OBJECT_DESTROY, 0,
+										led_output_cb_cached_buffer_destroy, entry);
+
+	return entry;
+}
+
+static void
+led_output_frame_free(void *data)
+{
+	led_output_frame_t *frame = (led_output_frame_t *)data;
+
+	free(frame->pixels);
+	free(frame);
+}
+
+static led_output_frame_t *
+led_output_get_frame(led_output_t *output, pepper_surface_t *surface)
+{
+	led_output_frame_t *frame;
+
+	frame = pepper_object_get_user_data((pepper_object_t *)surface, &KEY_FRAME);
+	if (frame)
+		return frame;
+
+	frame = (led_output_frame_t *)calloc(1, sizeof(led_output_frame_t));
+	PEPPER_CHECK(frame, return NULL, "fail to alloc a frame store\n");
+
+	/* one spare pixel for layout positions without an LED */
+	frame->pixels = (unsigned char *)calloc(output->num_led + 1, 4);
+	PEPPER_CHECK(frame->pixels, goto error, "fail to alloc a frame store\n");
+
+	pepper_object_set_user_data((pepper_object_t *)surface, &KEY_FRAME, frame,
+								led_output_frame_free);
+	return frame;
+
+error:
+	free(frame);
+	return NULL;
+}
+
+/* surfaces of a few sizes take turns on top, keep the tables of each size */
+static led_output_sampler_t *
+led_output_get_sampler(led_output_t *output, int width, int height)
+{
+	led_output_sampler_t *sampler = NULL;
+	int i;
+
+	for (i = 0; i < LED_OUTPUT_SAMPLER_CACHE; i++) {
+		if (output->samplers[i].src_w == width && output->samplers[i].src_h == height) {
+			sampler = &output->samplers[i];
+			break;
+		}
+
+		/* reuse an unused sampler, or else the least recently used one */
+		if (!sampler || (sampler->src_w && (!output->samplers[i].src_w ||
+				output->samplers[i].last_used < sampler->last_used)))
+			sampler = &output->samplers[i];
+	}
+
+	sampler->last_used = ++output->sampler_clock;
+	if (!led_output_sampler_prepare(sampler, width, height, output->layout_w, output->layout_h))
+		return NULL;
+
+	return sampler;
+}
+
+/* area-average the client pixels down to the LED layout */
+static pepper_bool_t
+led_output_sample(led_output_t *output, led_output_frame_t *frame,
+				const uint8_t *data, int width, int height, int stride)
+{
+	led_output_sampler_t *sampler;
+
+	sampler = led_output_get_sampler(output, width, height);
+	if (!sampler)
+		return PEPPER_FALSE;
+
+	led_output_sampler_run(sampler, frame->pixels, data, stride);
+	frame->count = (uint32_t)output->num_led;
+
+	return PEPPER_TRUE;
+}
+
+/* read from the client's shm pool, with the access bracketed */
+static pepper_bool_t
+led_output_capture_shm(led_output_t *output, led_output_frame_t *frame,
+						struct wl_shm_buffer *shm_buffer)
+{
+	uint32_t format;
+	int32_t width, height, stride;
+	pepper_bool_t ret;
+
+	format = wl_shm_buffer_get_format(shm_buffer);
+	PEPPER_CHECK(format == WL_SHM_FORMAT_ARGB8888 || format == WL_SHM_FORMAT_XRGB8888,
+				return PEPPER_FALSE, "unsupported shm format(0x%x)\n", format);
+
+	width = wl_shm_buffer_get_width(shm_buffer);
+	height = wl_shm_buffer_get_height(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	PEPPER_CHECK(width > 0 && height > 0 && stride >= width * 4,
+				return PEPPER_FALSE, "invalid shm buffer(%dx%d, stride:%d)\n", width, height, stride);
+
+	wl_shm_buffer_begin_access(shm_buffer);
+	ret = led_output_sample(output, frame, wl_shm_buffer_get_data(shm_buffer), width, height, stride);
+	wl_shm_buffer_end_access(shm_buffer);
+
+	return ret;
+}
+
+static pepper_bool_t
+led_output_capture_tbm(led_output_t *output, led_output_frame_t *frame, pepper_buffer_t *buf)
+{
+	led_output_buffer_t *entry;
+	tbm_surface_info_s *info;
+	pepper_bool_t ret = PEPPER_FALSE;
 
-	ret = tbm_surface_map(tbm_surface, TBM_SURF_OPTION_READ, &info);
-	PEPPER_CHECK(ret == TBM_SURFACE_ERROR_NONE, return, "fail to map the tbm_surface\n");
+	entry = led_output_get_buffer(output, buf);
+	if (!entry)
+		return PEPPER_FALSE;
 
-	if (!output->ui_led)
-		PEPPER_TRACE("[UPDATE LED] %s\n", (char*)info.planes[0].ptr);
+	/* counted here only, attach_surface may have imported the buffer for this frame */
+	if (entry->sampled)
+		output->buffer_hits++;
 	else
-		led_output_update_led(output, info.planes[0].ptr);
+		output->buffer_misses++;
+	entry->sampled = PEPPER_TRUE;
+
+	/* the buffer is released right after this, do not keep it mapped */
+	PEPPER_CHECK(tbm_surface_map(entry->tbm_surface, TBM_SURF_OPTION_READ, &entry->info) == TBM_SURFACE_ERROR_NONE,
+				return PEPPER_FALSE, "fail to map the tbm_surface\n");
+	entry->mapped = PEPPER_TRUE;
+
+	info = &entry->info;
+	PEPPER_CHECK(info->bpp == 32 && info->width > 0 && info->height > 0 &&
+				info->planes[0].stride >= info->width * 4,
+				goto unmap, "unsupported tbm_surface(%ux%u, bpp:%u, stride:%u)\n",
+				info->width, info->height, info->bpp, info->planes[0].stride);
 
-	tbm_surface_unmap(tbm_surface);
+	ret = led_output_sample(output, frame, info->planes[0].ptr, (int)info->width,
+							(int)info->height, (int)info->planes[0].stride);
+
+unmap:
+	tbm_surface_unmap(entry->tbm_surface);
+	entry->mapped = PEPPER_FALSE;
+
+	return ret;
 }
 
+/* keep the few pixels the LEDs need, so that the client buffer can be released */
 static void
-led_output_cb_frame_done(void *data)
+led_output_capture(led_output_t *output, pepper_surface_t *surface)
 {
-	led_output_t *output = (led_output_t *)data;
+	led_output_frame_t *frame;
+	pepper_buffer_t *buf;
+	struct wl_shm_buffer *shm_buffer;
+	pepper_bool_t ret;
 
-	PEPPER_TRACE("[OUTPUT] frame_done %p\n", output);
-	output->frame_done = NULL;
+	buf = pepper_surface_get_buffer(surface);
+	if (!buf)
+		return;
+
+	frame = led_output_get_frame(output, surface);
+	if (!frame)
+		return;
+
+	shm_buffer = wl_shm_buffer_get(pepper_buffer_get_resource(buf));
+	if (shm_buffer)
+		ret = led_output_capture_shm(output, frame, shm_buffer);
+	else
+		ret = led_output_capture_tbm(output, frame, buf);
 
-	pepper_output_finish_frame(output->output, NULL);
+	if (ret)
+		frame->serial = ++output->capture_serial;
 }
 
 static void
-led_output_add_frame_done(led_output_t *output)
+led_output_update(led_output_t *output)
 {
-	struct wl_event_loop *loop;
+	pepper_surface_t *surface;
+	led_output_frame_t *frame;
 
-	PEPPER_TRACE("[OUTPUT] Add idle for frame(output:%p, frame_done:%p)\n", output, output->frame_done);
+	/* feedbacks follow the top view's commits, unless it is not what the LEDs show */
+	if (output->top_view)
+		led_output_presentation_take(output, pepper_view_get_surface(output->top_view),
+									!output->anim);
 
-	if (!output || output->frame_done) {
-		PEPPER_TRACE("[OUTPUT] skip add frame_done\n");
+	/* a keyframe animation owns the LEDs until it ends */
+	if (output->anim)
+		return;
+
+	if (!output->top_view) {
+		if (led_output_is_presented(output, NULL, NULL, 0)) {
+			output->frames_skipped++;
+			return;
+		}
+
+		if (!led_output_has_led(output))
+			PEPPER_TRACE("[UPDATE LED] Empty Display\n");
+		else
+			led_output_update_led(output, NULL, 0);
+
+		led_output_set_presented(output, NULL, NULL, 0);
 		return;
 	}
 
-	loop = wl_display_get_event_loop(pepper_compositor_get_display(output->compositor));
-	PEPPER_CHECK(loop, return, "[OUTPUT] fail to get event loop\n");
+	surface = pepper_view_get_surface(output->top_view);
+	PEPPER_CHECK(surface, return, "fail to get a surafce from a view(%p)\n", output->top_view);
 
-	output->frame_done = wl_event_loop_add_idle(loop, led_output_cb_frame_done, output);
-	PEPPER_CHECK(output->frame_done, return, "[OUTPUT] fail to add idle\n");
+	frame = pepper_object_get_user_data((pepper_object_t *)surface, &KEY_FRAME);
+	PEPPER_CHECK(frame && frame->serial, return, "no frame captured from a surface(%p)\n", surface);
+
+	/* nothing new was captured since the last frame */
+	if (led_output_is_presented(output, output->top_view, surface, frame->serial)) {
+		PEPPER_TRACE("[OUTPUT] skip unchanged frame (view:%p, serial:%llu)\n", output->top_view,
+					(unsigned long long)frame->serial);
+		output->frames_skipped++;
+		return;
+	}
+
+	if (!led_output_has_led(output))
+		PEPPER_TRACE("[UPDATE LED] %u pixels\n", frame->count);
+	else
+		led_output_update_led(output, frame->pixels, frame->count);
+
+	led_output_set_presented(output, output->top_view, surface, frame->serial);
+}
+
+static int
+led_output_cb_write_done(int fd, uint32_t mask, void *data)
+{
+	led_output_strip_t *strip = (led_output_strip_t *)data;
+	led_output_t *output = (led_output_t *)strip->output;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0)
+		return 0;
+
+	PEPPER_TRACE("[OUTPUT] write_done %p strip@%d (frames:%llu)\n", output, strip->offset,
+				(unsigned long long)count);
+
+	/* frames written on behalf of others (e.g. boot animation) are ignored */
+	if (!strip->write_pending)
+		return 0;
+
+	strip->write_pending = PEPPER_FALSE;
+	output->writes_pending--;
+	led_output_latch(output, strip);
+	led_output_finish_frame(output);
+
+	return 0;
 }
 
 static void
-pepper_output_bind_display(led_output_t *output)
+led_output_start_writer(led_output_strip_t *strip)
 {
-	tbm_bufmgr bufmgr = NULL;
+	led_output_t *output = (led_output_t *)strip->output;
+	struct wl_event_loop *loop;
+	int fd;
 
-	PEPPER_CHECK(getenv("TBM_DISPLAY_SERVER"), return, "[TBM] run the subcompoitor mode\n");
+	PEPPER_CHECK(!HL_UI_LED_Start_Writer(strip->ui_led), return, "[OUTPUT] fail to start SPI writer\n");
 
-	bufmgr = wayland_tbm_server_get_bufmgr(output->tbm_server);
-	PEPPER_CHECK(bufmgr, return, "fail to get tbm_bufmgr\n");
+	loop = wl_display_get_event_loop(pepper_compositor_get_display(output->compositor));
+	PEPPER_CHECK(loop, goto error, "[OUTPUT] fail to get event loop\n");
 
-	if (!tbm_bufmgr_bind_native_display(bufmgr, (void *)pepper_compositor_get_display(output->compositor)))
-	{
-		PEPPER_CHECK(0, return, "fail to tbm_bufmgr_bind_native_display\n");
-	}
+	fd = HL_UI_LED_Get_Done_Fd(strip->ui_led);
+	strip->write_done = wl_event_loop_add_fd(loop, fd, WL_EVENT_READABLE,
+							led_output_cb_write_done, strip);
+	PEPPER_CHECK(strip->write_done, goto error, "[OUTPUT] fail to add write_done fd\n");
 
+	PEPPER_TRACE("[OUTPUT] SPI writer thread started (strip@%d)\n", strip->offset);
 	return;
+
+error:
+	HL_UI_LED_Stop_Writer(strip->ui_led);
 }
 
-pepper_bool_t
-headless_output_init(pepper_compositor_t *compositor)
+static void
+led_output_finish_frame(led_output_t *output)
 {
-	led_output_t *output = (led_output_t*)calloc(sizeof(led_output_t), 1);
-
-	PEPPER_TRACE("Output Init\n");
+	struct timespec ts;
+	pepper_bool_t hw_completion;
 
-	if (!output) {
-		PEPPER_ERROR("Failed to allocate memory in %s\n", __FUNCTION__);
-		goto error;
-	}
+	/* wait for both the refresh tick and the SPI transfers of every strip */
+	if (!output->frame_pending || output->vblank_pending || output->writes_pending)
+		return;
 
-	output->compositor = compositor;
-	output->tbm_server = wayland_tbm_server_init(pepper_compositor_get_display(compositor), NULL, -1, 0);
-	PEPPER_CHECK(output->tbm_server, goto error, "failed to wayland_tbm_server_init.\n");
+	output->frame_pending = PEPPER_FALSE;
 
-	pepper_output_bind_display(output);
+	/* the time comes from the SPI transfers only if every strip sent a full frame after the tick */
+	hw_completion = output->latch_complete && !output->latch_partial &&
+					output->latch_nsec >= output->vblank_nsec;
 
-	output->num_led = NUM_LED;
-	output->ui_led = HL_UI_LED_Init(output->num_led);
-	if (output->ui_led) HL_UI_LED_Change_Brightness(output->ui_led, 0x1);
+	/* not before the tick, and not before the LEDs latched what was sent */
+	if (output->latch_nsec < output->vblank_nsec)
+		output->latch_nsec = output->vblank_nsec;
 
-	if (!output->ui_led)
-		PEPPER_ERROR("HL_UI_LED_Init() failed.\n");
-	else
-		boot_ani_start(output);
+	ts.tv_sec = output->latch_nsec / NSEC_PER_SEC;
+	ts.tv_nsec = output->latch_nsec % NSEC_PER_SEC;
 
-	output->output = pepper_compositor_add_output(compositor,
-			&led_output_backend, "led_output",
-			output,  WL_OUTPUT_TRANSFORM_NORMAL, 1);
-	PEPPER_CHECK(output->output, goto error, "pepper_compositor_add_output() failed.\n");
+	led_output_presentation_present(output, output->latch_nsec, hw_completion);
+	led_output_latch_reset(output);
 
-	output->plane = pepper_output_add_plane(output->output, NULL);
-	PEPPER_CHECK(output->plane, goto error, "pepper_output_add_plane() failed.\n");
+	PEPPER_TRACE("[OUTPUT] finish frame %p (%ld.%09ld)\n", output, (long)ts.tv_sec, ts.tv_nsec);
+	pepper_output_finish_frame(output->output, &ts);
+}
 
-	pepper_object_set_user_data((pepper_object_t *)compositor,
-			&KEY_OUTPUT, output, NULL);
-	PEPPER_TRACE("\t Add Output %p, base %p\n", output, output->output);
-	PEPPER_TRACE("\t Add Output %p, plane %p\n", output, output->plane);
-	PEPPER_TRACE("\t Userdata %p\n", pepper_object_get_user_data((pepper_object_t *)compositor,&KEY_OUTPUT));
-	return PEPPER_TRUE;
+static int64_t
+led_output_get_time_nsec(void)
+{
+	struct timespec ts;
 
-error:
-	if (output->ui_led)
-		HL_UI_LED_Close(output->ui_led);
+	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	if (output->tbm_server)
-		wayland_tbm_server_deinit(output->tbm_server);
+	return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
 
-	if (output->output)
-		pepper_output_destroy(output->output);
+static void
+led_output_anim_stop(led_output_t *output)
+{
+	led_output_anim_destroy(output->anim);
+	output->anim = NULL;
 
-	if (output)
-		free(output);
-	return PEPPER_FALSE;
+	/* give the LEDs back to the top view */
+	output->presented.valid = PEPPER_FALSE;
+	led_output_update(output);
 }
 
-void
-headless_output_deinit(pepper_compositor_t *compositor)
+static void
+led_output_anim_tick(led_output_t *output)
 {
-	led_output_t *output;
+	const uint8_t *pixels;
+	pepper_bool_t done;
 
+	pixels = led_output_anim_render(output->anim, output->vblank_nsec, &done);
+	if (done) {
+		PEPPER_TRACE("[OUTPUT] keyframe animation ended\n");
+		led_output_anim_stop(output);
+		return;
+	}
 
-	output = pepper_object_get_user_data((pepper_object_t *)compositor, &KEY_OUTPUT);
+	if (led_output_has_led(output))
+		led_output_update_led(output, pixels, (uint32_t)output->num_led);
+}
+
+static int
+led_output_cb_refresh(int fd, uint32_t mask, void *data)
+{
+	led_output_t *output = (led_output_t *)data;
+	uint64_t expirations;
+
+	if (read(fd, &expirations, sizeof(expirations)) < 0)
+		return 0;
+
+	output->vblank_pending = PEPPER_FALSE;
+
+	if (output->anim)
+		led_output_anim_tick(output);
+
+	led_output_finish_frame(output);
+
+	/* keep the clock running while an animation plays */
+	if (output->anim && !output->vblank_pending)
+		led_output_schedule_vblank(output);
+
+	return 0;
+}
+
+static pepper_bool_t
+led_output_schedule_vblank(led_output_t *output)
+{
+	struct itimerspec its;
+	int64_t now, period;
+
+	period = NSEC_PER_SEC * 1000 / output->refresh;
+	now = led_output_get_time_nsec();
+
+	/* next tick on the refresh grid, keeping the phase of the last one */
+	if (output->vblank_nsec + period > now)
+		output->vblank_nsec += period;
+	else
+		output->vblank_nsec = now + period - (now - output->vblank_nsec) % period;
+
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = output->vblank_nsec / NSEC_PER_SEC;
+	its.it_value.tv_nsec = output->vblank_nsec % NSEC_PER_SEC;
+
+	if (timerfd_settime(output->refresh_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		PEPPER_ERROR("[OUTPUT] fail to arm refresh timer\n");
+		return PEPPER_FALSE;
+	}
+
+	output->vblank_pending = PEPPER_TRUE;
+	return PEPPER_TRUE;
+}
+
+static void
+led_output_cb_frame_done(void *data)
+{
+	led_output_t *output = (led_output_t *)data;
+
+	PEPPER_TRACE("[OUTPUT] frame_done %p\n", output);
+	output->frame_done = NULL;
+
+	output->vblank_nsec = led_output_get_time_nsec();
+	output->vblank_pending = PEPPER_FALSE;
+	led_output_finish_frame(output);
+}
+
+static void
+led_output_add_frame_done(led_output_t *output)
+{
+	struct wl_event_loop *loop;
+
+	PEPPER_TRACE("[OUTPUT] Add frame done(output:%p, frame_done:%p)\n", output, output->frame_done);
+
+	if (!output || output->frame_pending) {
+		PEPPER_TRACE("[OUTPUT] skip add frame_done\n");
+		return;
+	}
+
+	output->frame_pending = PEPPER_TRUE;
+
+	/* the clock may already be running for an animation */
+	if (output->refresh_source &&
+		(output->vblank_pending || led_output_schedule_vblank(output)))
+		return;
+
+	/* no refresh clock, finish the frame from an idle */
+	loop = wl_display_get_event_loop(pepper_compositor_get_display(output->compositor));
+	PEPPER_CHECK(loop, return, "[OUTPUT] fail to get event loop\n");
+
+	output->vblank_pending = PEPPER_TRUE;
+	output->frame_done = wl_event_loop_add_idle(loop, led_output_cb_frame_done, output);
+	PEPPER_CHECK(output->frame_done, return, "[OUTPUT] fail to add idle\n");
+}
+
+static void
+led_output_init_refresh_clock(led_output_t *output)
+{
+	struct wl_event_loop *loop;
+
+	output->refresh_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	PEPPER_CHECK(output->refresh_fd >= 0, return, "[OUTPUT] fail to create timerfd\n");
+
+	loop = wl_display_get_event_loop(pepper_compositor_get_display(output->compositor));
+	PEPPER_CHECK(loop, goto error, "[OUTPUT] fail to get event loop\n");
+
+	output->refresh_source = wl_event_loop_add_fd(loop, output->refresh_fd, WL_EVENT_READABLE,
+								led_output_cb_refresh, output);
+	PEPPER_CHECK(output->refresh_source, goto error, "[OUTPUT] fail to add refresh fd\n");
+
+	output->vblank_nsec = led_output_get_time_nsec();
+	return;
+
+error:
+	close(output->refresh_fd);
+	output->refresh_fd = -1;
+}
+
+static void
+pepper_output_bind_display(led_output_t *output)
+{
+	tbm_bufmgr bufmgr = NULL;
+
+	PEPPER_CHECK(getenv("TBM_DISPLAY_SERVER"), return, "[TBM] run the subcompoitor mode\n");
+
+	bufmgr = wayland_tbm_server_get_bufmgr(output->tbm_server);
+	PEPPER_CHECK(bufmgr, return, "fail to get tbm_bufmgr\n");
+
+	if (!tbm_bufmgr_bind_native_display(bufmgr, (void *)pepper_compositor_get_display(output->compositor)))
+	{
+		PEPPER_CHECK(0, return, "fail to tbm_bufmgr_bind_native_display\n");
+	}
+
+	return;
+}
+
+static HL_UI_LED *
+led_output_open_led(const led_output_config_t *config, int index)
+{
+	const led_output_strip_config_t *strip = &config->strips[index];
+	const HL_UI_LED_Driver *driver;
+	HL_UI_LED_Param param;
+	char path[LED_CONFIG_STR_MAX + 8];
+
+	driver = HL_UI_LED_Find_Driver(config->driver);
+	PEPPER_CHECK(driver, return NULL, "[OUTPUT] unknown LED driver '%s'\n", config->driver);
+
+	memset(&param, 0, sizeof(param));
+	param.spi_bus = strip->spi_bus;
+	param.spi_dev = strip->spi_dev;
+	param.bitrate = config->bitrate;
+	param.slots = (uint32_t)config->virtual_slots;
+	param.throttle = config->virtual_throttle;
+	/* the first frame clears the LEDs at the output's brightness already */
+	param.brightness = LED_OUTPUT_BRIGHTNESS;
+
+	/* one ring per strip */
+	if (config->virtual_path[0]) {
+		if (config->num_strips > 1)
+			snprintf(path, sizeof(path), "%s.%d", config->virtual_path, index);
+		else
+			snprintf(path, sizeof(path), "%s", config->virtual_path);
+		param.path = path;
+	}
+
+	return HL_UI_LED_Init_Driver(strip->num_led, driver, &param);
+}
+
+/* opened by headless_output_boot() before the compositor, for headless_output_init() */
+static led_output_t *early_output;
+
+static led_output_t *
+led_output_create(void)
+{
+	led_output_t *output = (led_output_t*)calloc(sizeof(led_output_t), 1);
+	led_output_strip_t *strip;
+	int i, offset = 0;
+
+	PEPPER_CHECK(output, return NULL, "Failed to allocate memory in %s\n", __FUNCTION__);
+
+	output->refresh = LED_OUTPUT_REFRESH;
+	output->refresh_fd = -1;
+	output->retry_delay = LED_OUTPUT_RETRY_MIN;
+
+	led_output_config_load(&output->config);
+	output->num_led = output->config.num_led;
+	output->num_strips = output->config.num_strips;
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		strip->output = output;
+		strip->offset = offset;
+		strip->num_led = output->config.strips[i].num_led;
+		offset += strip->num_led;
+	}
+
+	return output;
+}
+
+/* an opened LED device becomes the strip's */
+static void
+led_output_attach_led(led_output_t *output, led_output_strip_t *strip, HL_UI_LED *ui_led)
+{
+	strip->ui_led = ui_led;
+	HL_UI_LED_Set_Truncate(strip->ui_led, output->config.truncate_frames);
+	boot_ani_add_strip(output, strip);
+	output->strips_attached++;
+}
+
+/* one attempt per strip not opened yet, returns whether any LED is usable */
+pepper_bool_t
+led_output_open_strips(led_output_t *output)
+{
+	led_output_strip_t *strip;
+	HL_UI_LED *ui_led;
+	int i;
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (strip->ui_led)
+			continue;
+
+		ui_led = led_output_open_led(&output->config, i);
+		if (!ui_led) {
+			PEPPER_ERROR("HL_UI_LED_Init() failed for strip %d.\n", i);
+			continue;
+		}
+
+		led_output_attach_led(output, strip, ui_led);
+	}
+
+	return led_output_has_led(output);
+}
+
+led_output_opener_t *
+led_output_opener_create(led_output_t *output)
+{
+	led_output_opener_t *opener;
+
+	opener = (led_output_opener_t *)calloc(1, sizeof(led_output_opener_t));
+	PEPPER_CHECK(opener, return NULL, "[OUTPUT] fail to alloc the strip opener\n");
+
+	pthread_mutex_init(&opener->lock, NULL);
+	opener->config = output->config;
+	opener->num_strips = output->num_strips;
+
+	return opener;
+}
+
+void
+led_output_opener_destroy(led_output_opener_t *opener)
+{
+	int i;
+
+	for (i = 0; i < opener->num_strips; i++) {
+		if (opener->leds[i])
+			HL_UI_LED_Close(opener->leds[i]);
+	}
+
+	pthread_mutex_destroy(&opener->lock);
+	free(opener);
+}
+
+/* on the boot-animation thread, TRUE if the LEDs are still the thread's to use */
+pepper_bool_t
+led_output_opener_run(led_output_opener_t *opener)
+{
+	pepper_bool_t abandoned, orphaned;
+	int i;
+
+	for (i = 0; i < opener->num_strips; i++) {
+		opener->leds[i] = led_output_open_led(&opener->config, i);
+		if (!opener->leds[i])
+			PEPPER_ERROR("HL_UI_LED_Init() failed for strip %d.\n", i);
+	}
+
+	pthread_mutex_lock(&opener->lock);
+	opener->done = PEPPER_TRUE;
+	abandoned = opener->abandoned;
+	orphaned = opener->orphaned;
+	pthread_mutex_unlock(&opener->lock);
+
+	if (orphaned)
+		led_output_opener_destroy(opener);
+
+	return !abandoned;
+}
+
+/* stop waiting for a thread still opening, FALSE if it is done already */
+pepper_bool_t
+led_output_opener_abandon(led_output_t *output, led_output_opener_t *opener)
+{
+	pepper_bool_t done;
+
+	pthread_mutex_lock(&opener->lock);
+	done = opener->done;
+	if (!done)
+		opener->abandoned = PEPPER_TRUE;
+	pthread_mutex_unlock(&opener->lock);
+
+	if (done)
+		return PEPPER_FALSE;
+
+	PEPPER_TRACE("[OUTPUT] strips are still being opened, adopt them later\n");
+	output->opener = opener;
+	return PEPPER_TRUE;
+}
+
+static pepper_bool_t
+led_output_opener_is_done(led_output_opener_t *opener)
+{
+	pepper_bool_t done;
+
+	pthread_mutex_lock(&opener->lock);
+	done = opener->done;
+	pthread_mutex_unlock(&opener->lock);
+
+	return done;
+}
+
+/* the output goes away, whoever finishes last closes the LEDs */
+static void
+led_output_opener_orphan(led_output_t *output)
+{
+	led_output_opener_t *opener = output->opener;
+	pepper_bool_t done;
+
+	if (!opener)
+		return;
+
+	output->opener = NULL;
+
+	pthread_mutex_lock(&opener->lock);
+	done = opener->done;
+	if (!done)
+		opener->orphaned = PEPPER_TRUE;
+	pthread_mutex_unlock(&opener->lock);
+
+	if (done)
+		led_output_opener_destroy(opener);
+}
+
+pepper_bool_t
+led_output_adopt_strips(led_output_t *output, led_output_opener_t *opener)
+{
+	int i;
+
+	for (i = 0; i < output->num_strips; i++) {
+		if (!opener->leds[i] || output->strips[i].ui_led)
+			continue;
+
+		led_output_attach_led(output, &output->strips[i], opener->leds[i]);
+		opener->leds[i] = NULL;
+	}
+
+	return led_output_has_led(output);
+}
+
+static pepper_bool_t
+led_output_use_writer(led_output_t *output)
+{
+	/* several strips only transmit in parallel from their own writers */
+	return output->config.async_write || output->num_strips > 1;
+}
+
+static void
+led_output_detach_strip(led_output_t *output, led_output_strip_t *strip)
+{
+	if (!strip->ui_led)
+		return;
+
+	PEPPER_TRACE("[OUTPUT] detach strip@%d\n", strip->offset);
+
+	if (strip->write_done) {
+		wl_event_source_remove(strip->write_done);
+		strip->write_done = NULL;
+	}
+
+	HL_UI_LED_Close(strip->ui_led);
+	strip->ui_led = NULL;
+	output->strips_detached++;
+
+	/* do not wait for a transfer that will never be signalled */
+	if (strip->write_pending) {
+		strip->write_pending = PEPPER_FALSE;
+		output->writes_pending--;
+		output->latch_partial = PEPPER_TRUE;
+		led_output_finish_frame(output);
+	}
+}
+
+static pepper_bool_t
+led_output_retry_strips(led_output_t *output)
+{
+	led_output_strip_t *strip;
+	led_output_opener_t *opener = NULL;
+	HL_UI_LED *ui_led;
+	pepper_bool_t closed = PEPPER_FALSE;
+	int i;
+
+	/* do not open a device the boot-animation thread may still be stuck on */
+	if (output->opener) {
+		if (!led_output_opener_is_done(output->opener))
+			return PEPPER_FALSE;
+
+		opener = output->opener;
+		output->opener = NULL;
+	}
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (strip->ui_led)
+			continue;
+
+		ui_led = NULL;
+		if (opener) {
+			ui_led = opener->leds[i];
+			opener->leds[i] = NULL;
+		}
+
+		if (!ui_led)
+			ui_led = led_output_open_led(&output->config, i);
+		if (!ui_led) {
+			closed = PEPPER_TRUE;
+			continue;
+		}
+
+		PEPPER_TRACE("[OUTPUT] strip@%d is back\n", strip->offset);
+		led_output_attach_led(output, strip, ui_led);
+
+		if (led_output_use_writer(output))
+			led_output_start_writer(strip);
+
+		/* show the current frame again on all the strips */
+		output->presented.valid = PEPPER_FALSE;
+	}
+
+	if (opener)
+		led_output_opener_destroy(opener);
+
+	if (!output->presented.valid && !output->boot_ani)
+		led_output_update(output);
+
+	return !closed;
+}
+
+static int
+led_output_cb_retry(void *data)
+{
+	led_output_t *output = (led_output_t *)data;
+
+	if (led_output_retry_strips(output)) {
+		output->retry_delay = LED_OUTPUT_RETRY_MIN;
+		return 0;
+	}
+
+	/* back off while the device does not show up */
+	if (output->retry_delay < LED_OUTPUT_RETRY_MAX)
+		output->retry_delay *= 2;
+	if (output->retry_delay > LED_OUTPUT_RETRY_MAX)
+		output->retry_delay = LED_OUTPUT_RETRY_MAX;
+
+	wl_event_source_timer_update(output->retry_timer, output->retry_delay);
+	return 0;
+}
+
+static void
+led_output_schedule_retry(led_output_t *output, int delay)
+{
+	struct wl_event_loop *loop;
+
+	if (!output->retry_timer) {
+		loop = wl_display_get_event_loop(pepper_compositor_get_display(output->compositor));
+		PEPPER_CHECK(loop, return, "[OUTPUT] fail to get event loop\n");
+
+		output->retry_timer = wl_event_loop_add_timer(loop, led_output_cb_retry, output);
+		PEPPER_CHECK(output->retry_timer, return, "[OUTPUT] fail to add retry timer\n");
+	}
+
+	wl_event_source_timer_update(output->retry_timer, delay);
+}
+
+static led_output_strip_t *
+led_output_find_spidev(led_output_t *output, const char *name)
+{
+	int i, bus, dev, len = 0;
+
+	if (!name || sscanf(name, "spidev%d.%d%n", &bus, &dev, &len) != 2 || name[len] != '\0')
+		return NULL;
+
+	for (i = 0; i < output->num_strips; i++) {
+		if (output->config.strips[i].spi_bus == bus && output->config.strips[i].spi_dev == dev)
+			return &output->strips[i];
+	}
+
+	return NULL;
+}
+
+static void
+led_output_cb_dev_event(uint32_t type, pepper_inotify_event_t *ev, void *data)
+{
+	led_output_t *output = (led_output_t *)data;
+	led_output_strip_t *strip;
+	char *name, *base;
+
+	name = pepper_inotify_event_name_get(ev);
+	base = name ? strrchr(name, '/') : NULL;
+	strip = led_output_find_spidev(output, base ? base + 1 : name);
+	if (!strip)
+		return;
+
+	switch (type) {
+	case PEPPER_INOTIFY_EVENT_TYPE_CREATE:
+		/* the node appeared, try now rather than at the next backoff */
+		if (!strip->ui_led) {
+			output->retry_delay = LED_OUTPUT_RETRY_MIN;
+			led_output_schedule_retry(output, 1);
+		}
+		break;
+	case PEPPER_INOTIFY_EVENT_TYPE_REMOVE:
+		led_output_detach_strip(output, strip);
+		output->retry_delay = LED_OUTPUT_RETRY_MIN;
+		led_output_schedule_retry(output, output->retry_delay);
+		break;
+	default:
+		break;
+	}
+}
+
+/* strips not opened yet, or unplugged later, are reopened in the background */
+static void
+led_output_init_hotplug(led_output_t *output)
+{
+	int i;
+
+	if (!strcmp(output->config.driver, HL_UI_LED_Driver_Spi.name)) {
+		output->inotify = pepper_inotify_create(output->compositor, led_output_cb_dev_event, output);
+		if (output->inotify && !pepper_inotify_add(output->inotify, "/dev")) {
+			PEPPER_ERROR("[OUTPUT] fail to watch /dev for spidev nodes\n");
+			pepper_inotify_destroy(output->inotify);
+			output->inotify = NULL;
+		}
+	}
+
+	for (i = 0; i < output->num_strips; i++) {
+		if (!output->strips[i].ui_led) {
+			led_output_schedule_retry(output, output->retry_delay);
+			break;
+		}
+	}
+}
+
+static void
+led_output_free(led_output_t *output)
+{
+	led_output_strip_t *strip;
+	int i;
+
+	if (output->boot_ani)
+		boot_ani_stop(output);
+
+	led_output_opener_orphan(output);
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (strip->write_done)
+			wl_event_source_remove(strip->write_done);
+		if (strip->ui_led)
+			HL_UI_LED_Close(strip->ui_led);
+	}
+
+	free(output);
+}
+
+pepper_bool_t
+headless_output_boot(void)
+{
+	led_output_t *output;
+
+	PEPPER_CHECK(!early_output, return PEPPER_TRUE, "[OUTPUT] LEDs are already opened\n");
+
+	output = led_output_create();
+	if (!output)
+		return PEPPER_FALSE;
+
+	/* the thread opens the strips, so a slow device does not hold startup */
+	boot_ani_start_thread(output);
+	if (!output->boot_ani)
+		led_output_open_strips(output);
+
+	early_output = output;
+	return PEPPER_TRUE;
+}
+
+pepper_bool_t
+headless_output_init(pepper_compositor_t *compositor)
+{
+	led_output_t *output;
+	led_output_strip_t *strip;
+	int i;
+
+	PEPPER_TRACE("Output Init\n");
+
+	/* take over the LEDs and the boot animation from headless_output_boot() */
+	if (early_output) {
+		output = early_output;
+		early_output = NULL;
+	} else {
+		output = led_output_create();
+		if (!output)
+			return PEPPER_FALSE;
+
+		led_output_open_strips(output);
+	}
+
+	output->compositor = compositor;
+	output->tbm_server = wayland_tbm_server_init(pepper_compositor_get_display(compositor), NULL, -1, 0);
+	PEPPER_CHECK(output->tbm_server, goto error, "failed to wayland_tbm_server_init.\n");
+
+	pepper_output_bind_display(output);
+
+	output->remap = led_output_layout_build(&output->config, &output->layout_w, &output->layout_h);
+	PEPPER_CHECK(output->remap, goto error, "led_output_layout_build() failed.\n");
+	for (i = 0; i < LED_OUTPUT_SAMPLER_CACHE; i++)
+		output->samplers[i].remap = output->remap;
+
+	if (output->boot_ani)
+		boot_ani_attach(output);
+	else if (led_output_has_led(output))
+		boot_ani_start(output);
+
+	/* writers start once the boot-animation thread no longer writes */
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		if (!strip->ui_led)
+			continue;
+
+		if (led_output_use_writer(output))
+			led_output_start_writer(strip);
+	}
+
+	output->output = pepper_compositor_add_output(compositor,
+			&led_output_backend, "led_output",
+			output,  WL_OUTPUT_TRANSFORM_NORMAL, 1);
+	PEPPER_CHECK(output->output, goto error, "pepper_compositor_add_output() failed.\n");
+
+	output->plane = pepper_output_add_plane(output->output, NULL);
+	PEPPER_CHECK(output->plane, goto error, "pepper_output_add_plane() failed.\n");
+
+	led_output_init_refresh_clock(output);
+	led_output_init_hotplug(output);
+
+	if (!led_output_presentation_init(output))
+		PEPPER_ERROR("[OUTPUT] no presentation feedback\n");
+
+	pepper_object_set_user_data((pepper_object_t *)compositor,
+			&KEY_OUTPUT, output, NULL);
+	PEPPER_TRACE("\t Add Output %p, base %p\n", output, output->output);
+	PEPPER_TRACE("\t Add Output %p, plane %p\n", output, output->plane);
+	PEPPER_TRACE("\t Userdata %p\n", pepper_object_get_user_data((pepper_object_t *)compositor,&KEY_OUTPUT));
+	return PEPPER_TRUE;
+
+error:
+	if (output->refresh_source)
+		wl_event_source_remove(output->refresh_source);
+
+	if (output->refresh_fd >= 0)
+		close(output->refresh_fd);
+
+	if (output->remap) {
+		free(output->remap);
+		output->remap = NULL;
+	}
+
+	if (output->tbm_server)
+		wayland_tbm_server_deinit(output->tbm_server);
+
+	if (output->output)
+		pepper_output_destroy(output->output);
+
+	led_output_free(output);
+	return PEPPER_FALSE;
+}
+
+void
+headless_output_debug_status(pepper_compositor_t *compositor)
+{
+	led_output_t *output;
+	led_output_strip_t *strip;
+	uint64_t frames = 0, bytes = 0, dropped = 0;
+	uint64_t truncated = 0, unchanged = 0;
+	int i;
+
+	output = pepper_object_get_user_data((pepper_object_t *)compositor, &KEY_OUTPUT);
+	PEPPER_CHECK(output, return, "[OUTPUT] no led output\n");
+
+	PEPPER_TRACE("========= [LED output status] =========\n");
+	PEPPER_TRACE("\t num_led=%d, driver=%s, bitrate=%u, strips=%d\n", output->num_led,
+				output->config.driver, output->config.bitrate, output->num_strips);
+	PEPPER_TRACE("\t frames presented=%llu, skipped=%llu\n",
+				(unsigned long long)output->frames_presented,
+				(unsigned long long)output->frames_skipped);
+	PEPPER_TRACE("\t presentation seq=%llu, last at %lld ns, hw completion=%llu\n",
+				(unsigned long long)output->present_seq, (long long)output->present_nsec,
+				(unsigned long long)output->present_hw);
+	PEPPER_TRACE("\t buffer cache hits=%llu, misses=%llu (hit rate %llu%%)\n",
+				(unsigned long long)output->buffer_hits,
+				(unsigned long long)output->buffer_misses,
+				(unsigned long long)(output->buffer_hits + output->buffer_misses ?
+					output->buffer_hits * 100 / (output->buffer_hits + output->buffer_misses) : 0));
+	PEPPER_TRACE("\t convert=%s\n", hl_ui_led_convert_name());
+	PEPPER_TRACE("\t strips attached=%llu, detached=%llu, retry delay=%d ms\n",
+				(unsigned long long)output->strips_attached,
+				(unsigned long long)output->strips_detached, output->retry_delay);
+	PEPPER_TRACE("\t layout=%dx%d, keyframe animation=%s (ticks:%llu)\n",
+				output->layout_w, output->layout_h, output->anim ? "playing" : "none",
+				(unsigned long long)(output->anim ? led_output_anim_get_ticks(output->anim) : 0));
+
+	for (i = 0; i < output->num_strips; i++) {
+		strip = &output->strips[i];
+		PEPPER_TRACE("\t [strip %d] spi=%d.%d, leds=%d..%d\n", i,
+					output->config.strips[i].spi_bus, output->config.strips[i].spi_dev,
+					strip->offset, strip->offset + strip->num_led - 1);
+
+		if (!strip->ui_led) {
+			PEPPER_TRACE("\t\t LED device is not opened\n");
+			continue;
+		}
+
+		HL_UI_LED_Get_Stats(strip->ui_led, &frames, &bytes, &dropped);
+		PEPPER_TRACE("\t\t frames written=%llu, bytes written=%llu (frame size %u)\n",
+					(unsigned long long)frames, (unsigned long long)bytes,
+					strip->ui_led->frame_len);
+		PEPPER_TRACE("\t\t writer=%s, frames dropped=%llu\n",
+					strip->write_done ? "async" : "sync",
+					(unsigned long long)dropped);
+
+		HL_UI_LED_Get_Truncate_Stats(strip->ui_led, &truncated, &unchanged);
+		PEPPER_TRACE("\t\t truncate=%s, frames truncated=%llu, unchanged=%llu\n",
+					output->config.truncate_frames ? "on" : "off",
+					(unsigned long long)truncated, (unsigned long long)unchanged);
+	}
+}
+
+void
+headless_output_get_layout(pepper_compositor_t *compositor, int *width, int *height)
+{
+	led_output_t *output;
+
+	output = pepper_object_get_user_data((pepper_object_t *)compositor, &KEY_OUTPUT);
+	PEPPER_CHECK(output, return, "[OUTPUT] no led output\n");
+
+	if (width)
+		*width = output->layout_w;
+	if (height)
+		*height = output->layout_h;
+}
+
+pepper_bool_t
+headless_output_play_keyframes(pepper_compositor_t *compositor,
+						const headless_output_keyframe_t *keyframes, int count, int repeat)
+{
+	led_output_t *output;
+	led_output_anim_t *anim;
+
+	output = pepper_object_get_user_data((pepper_object_t *)compositor, &KEY_OUTPUT);
+	PEPPER_CHECK(output, return PEPPER_FALSE, "[OUTPUT] no led output\n");
+	PEPPER_CHECK(output->refresh_source, return PEPPER_FALSE, "[OUTPUT] no refresh clock to animate\n");
+
+	anim = led_output_anim_create(output, keyframes, count, repeat, led_output_get_time_nsec());
+	if (!anim)
+		return PEPPER_FALSE;
+
+	if (output->boot_ani)
+		boot_ani_stop(output);
+
+	/* a new sequence replaces the one playing */
+	if (output->anim)
+		led_output_anim_destroy(output->anim);
+	output->anim = anim;
+
+	PEPPER_TRACE("[OUTPUT] play %d keyframes (repeat:%d)\n", count, repeat);
+
+	if (!output->vblank_pending)
+		led_output_schedule_vblank(output);
+
+	return PEPPER_TRUE;
+}
+
+void
+headless_output_stop_keyframes(pepper_compositor_t *compositor)
+{
+	led_output_t *output;
+
+	output = pepper_object_get_user_data((pepper_object_t *)compositor, &KEY_OUTPUT);
+	PEPPER_CHECK(output, return, "[OUTPUT] no led output\n");
+
+	if (output->anim)
+		led_output_anim_stop(output);
+}
+
+void
+headless_output_deinit(pepper_compositor_t *compositor)
+{
+	led_output_t *output = NULL;
+
+	/* headless_output_init() never took the LEDs over */
+	if (early_output) {
+		led_output_free(early_output);
+		early_output = NULL;
+	}
+
+	if (compositor)
+		output = pepper_object_get_user_data((pepper_object_t *)compositor, &KEY_OUTPUT);
 
 	if (output) {
 		pepper_object_set_user_data((pepper_object_t *)compositor, &KEY_OUTPUT, NULL, NULL);
@@ -0,0 +1,297 @@
+/*
+* Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pepper.h>
+#include <presentation-time-server-protocol.h>
+#include "HL_UI_LED.h"
+#include "output_internal.h"
+
+/*
+ * wp_presentation for the LED output. A feedback follows the next commit
+ * of its surface. When the output shows that commit, the feedback waits
+ * for the end of the frame, i.e. for the SPI transfers, and gets its time.
+ * A feedback is discarded when a newer commit replaces its content before
+ * it was shown, or when the LEDs show something else (e.g. an animation).
+ */
+#define NSEC_PER_SEC	1000000000LL
+
+static const int KEY_FEEDBACK;
+
+typedef struct {
+	struct wl_resource *resource;
+	struct wl_list link;
+} led_output_feedback_t;
+
+/* feedbacks of a surface */
+typedef struct {
+	struct wl_list pending;	/* requested since the last commit */
+	struct wl_list committed;	/* for the last commit, not shown yet */
+	pepper_event_listener_t *commit_listener;
+	pepper_event_listener_t *destroy_listener;
+} led_output_surface_feedback_t;
+
+static void
+led_output_feedback_cb_resource_destroy(struct wl_resource *resource)
+{
+	led_output_feedback_t *feedback = wl_resource_get_user_data(resource);
+
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+static void
+led_output_feedback_discard_list(struct wl_list *list)
+{
+	led_output_feedback_t *feedback, *tmp;
+
+	wl_list_for_each_safe(feedback, tmp, list, link) {
+		wp_presentation_feedback_send_discarded(feedback->resource);
+		wl_resource_destroy(feedback->resource);
+	}
+}
+
+static void
+led_output_feedback_cb_surface_commit(pepper_event_listener_t *listener,
+										pepper_object_t *object,
+										uint32_t id, void *info, void *data)
+{
+	led_output_surface_feedback_t *sf = (led_output_surface_feedback_t *)data;
+
+	/* the content the older feedbacks wait for will never be shown */
+	led_output_feedback_discard_list(&sf->committed);
+
+	wl_list_insert_list(&sf->committed, &sf->pending);
+	wl_list_init(&sf->pending);
+}
+
+static void
+led_output_feedback_cb_surface_destroy(pepper_event_listener_t *listener,
+										pepper_object_t *object,
+										uint32_t id, void *info, void *data)
+{
+	led_output_surface_feedback_t *sf = (led_output_surface_feedback_t *)data;
+
+	led_output_feedback_discard_list(&sf->pending);
+	led_output_feedback_discard_list(&sf->committed);
+
+	if (sf->commit_listener)
+		pepper_event_listener_remove(sf->commit_listener);
+
+	pepper_object_set_user_data(object, &KEY_FEEDBACK, NULL, NULL);
+	free(sf);
+}
+
+static led_output_surface_feedback_t *
+led_output_get_surface_feedback(pepper_surface_t *surface)
+{
+	led_output_surface_feedback_t *sf;
+
+	sf = pepper_object_get_user_data((pepper_object_t *)surface, &KEY_FEEDBACK);
+	if (sf)
+		return sf;
+
+	sf = (led_output_surface_feedback_t *)calloc(1, sizeof(led_output_surface_feedback_t));
+	PEPPER_CHECK(sf, return NULL, "[OUTPUT] fail to alloc surface feedback\n");
+
+	wl_list_init(&sf->pending);
+	wl_list_init(&sf->committed);
+	sf->commit_listener = pepper_object_add_event_listener((pepper_object_t *)surface,
+									PEPPER_EVENT_SURFACE_COMMIT, 0,
+									led_output_feedback_cb_surface_commit, sf);
+	sf->destroy_listener = pepper_object_add_event_listener((pepper_object_t *)surface,
+									PEPPER_EVENT_OBJECT_DESTROY, 0,
+									led_output_feedback_cb_surface_destroy, sf);
+	PEPPER_CHECK(sf->commit_listener && sf->destroy_listener, goto error,
+				"[OUTPUT] fail to listen to surface(%p)\n", surface);
+
+	pepper_object_set_user_data((pepper_object_t *)surface, &KEY_FEEDBACK, sf, NULL);
+	return sf;
+
+error:
+	if (sf->commit_listener)
+		pepper_event_listener_remove(sf->commit_listener);
+	if (sf->destroy_listener)
+		pepper_event_listener_remove(sf->destroy_listener);
+	free(sf);
+	return NULL;
+}
+
+static void
+presentation_cb_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+presentation_cb_feedback(struct wl_client *client, struct wl_resource *resource,
+						struct wl_resource *surface_res, uint32_t callback)
+{
+	led_output_surface_feedback_t *sf;
+	led_output_feedback_t *feedback;
+	pepper_surface_t *surface;
+
+	surface = wl_resource_get_user_data(surface_res);
+	PEPPER_CHECK(surface, return, "[OUTPUT] invalid surface for feedback\n");
+
+	sf = led_output_get_surface_feedback(surface);
+	if (!sf) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	feedback = (led_output_feedback_t *)calloc(1, sizeof(led_output_feedback_t));
+	PEPPER_CHECK(feedback, goto no_memory, "[OUTPUT] fail to alloc feedback\n");
+
+	feedback->resource = wl_resource_create(client, &wp_presentation_feedback_interface, 1, callback);
+	PEPPER_CHECK(feedback->resource, goto no_memory, "[OUTPUT] fail to create feedback resource\n");
+
+	wl_resource_set_implementation(feedback->resource, NULL, feedback,
+								led_output_feedback_cb_resource_destroy);
+	wl_list_insert(sf->pending.prev, &feedback->link);
+	return;
+
+no_memory:
+	free(feedback);
+	wl_client_post_no_memory(client);
+}
+
+static const struct wp_presentation_interface presentation_implementation = {
+	presentation_cb_destroy,
+	presentation_cb_feedback,
+};
+
+static void
+presentation_cb_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	led_output_t *output = (led_output_t *)data;
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wp_presentation_interface, 1, id);
+	if (!resource) {
+		PEPPER_ERROR("fail to create resource for wp_presentation\n");
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &presentation_implementation, output, NULL);
+	wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+pepper_bool_t
+led_output_presentation_init(led_output_t *output)
+{
+	struct wl_display *display;
+
+	wl_list_init(&output->feedback_list);
+
+	display = pepper_compositor_get_display(output->compositor);
+	output->presentation = wl_global_create(display, &wp_presentation_interface, 1, output,
+											presentation_cb_bind);
+	PEPPER_CHECK(output->presentation, return PEPPER_FALSE, "fail to create wp_presentation global\n");
+
+	return PEPPER_TRUE;
+}
+
+void
+led_output_presentation_fini(led_output_t *output)
+{
+	if (!output->presentation)
+		return;
+
+	led_output_feedback_discard_list(&output->feedback_list);
+	wl_global_destroy(output->presentation);
+	output->presentation = NULL;
+}
+
+/* the output decided what the LEDs show for the next frame */
+void
+led_output_presentation_take(led_output_t *output, pepper_surface_t *surface, pepper_bool_t shown)
+{
+	led_output_surface_feedback_t *sf;
+
+	if (!output->presentation || !surface)
+		return;
+
+	sf = pepper_object_get_user_data((pepper_object_t *)surface, &KEY_FEEDBACK);
+	if (!sf || wl_list_empty(&sf->committed))
+		return;
+
+	if (!shown) {
+		led_output_feedback_discard_list(&sf->committed);
+		return;
+	}
+
+	wl_list_insert_list(output->feedback_list.prev, &sf->committed);
+	wl_list_init(&sf->committed);
+}
+
+static enum wl_iterator_result
+led_output_feedback_sync_output(struct wl_resource *resource, void *data)
+{
+	struct wl_resource *feedback = (struct wl_resource *)data;
+
+	/* the LEDs are the only output, any wl_output of the client is theirs */
+	if (!strcmp(wl_resource_get_class(resource), wl_output_interface.name))
+		wp_presentation_feedback_send_sync_output(feedback, resource);
+
+	return WL_ITERATOR_CONTINUE;
+}
+
+/* a frame ended at 'nsec', 'hw_completion' if that is when the SPI transfers of all the strips ended */
+void
+led_output_presentation_present(led_output_t *output, int64_t nsec, pepper_bool_t hw_completion)
+{
+	led_output_feedback_t *feedback, *tmp;
+	uint64_t sec;
+	uint32_t refresh, flags;
+
+	output->present_seq++;
+	output->present_nsec = nsec;
+	if (hw_completion)
+		output->present_hw++;
+
+	if (!output->presentation || wl_list_empty(&output->feedback_list))
+		return;
+
+	sec = (uint64_t)(nsec / NSEC_PER_SEC);
+	refresh = (uint32_t)(NSEC_PER_SEC * 1000 / output->refresh);
+
+	flags = WP_PRESENTATION_FEEDBACK_KIND_VSYNC;
+	if (hw_completion)
+		flags |= WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+
+	wl_list_for_each_safe(feedback, tmp, &output->feedback_list, link) {
+		wl_client_for_each_resource(wl_resource_get_client(feedback->resource),
+									led_output_feedback_sync_output, feedback->resource);
+		wp_presentation_feedback_send_presented(feedback->resource,
+							(uint32_t)(sec >> 32), (uint32_t)sec,
+							(uint32_t)(nsec % NSEC_PER_SEC), refresh,
+							(uint32_t)(output->present_seq >> 32), (uint32_t)output->present_seq,
+							flags);
+		wl_resource_destroy(feedback->resource);
+	}
+}
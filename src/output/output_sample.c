@@ -0,0 +1,187 @@
+/*
+* Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pepper.h>
+#include "HL_UI_LED.h"
+#include "output_internal.h"
+
+/*
+ * Client buffers of any size are area-averaged down to the LED layout.
+ * Each LED covers a box of source pixels whose bounds are computed once per
+ * (source size, layout) pair. Per frame, the source rows of a box row are
+ * summed into a per-column accumulator (a widening add done with generic
+ * vectors), then each LED sums its columns in 64 bits and divides by the
+ * area of its box. The division is exact, even for a whole buffer going to
+ * a single LED. All 4 bytes of a pixel are averaged alike.
+ * Results are stored straight at their LED index through the layout's
+ * remap table.
+ */
+#if (defined(__GNUC__) && __GNUC__ >= 9) || defined(__clang__)
+typedef uint8_t sample_u8x16_t __attribute__((vector_size(16)));
+typedef uint32_t sample_u32x16_t __attribute__((vector_size(64)));
+#define HAVE_SAMPLE_VECTOR 1
+#endif
+
+static void
+led_output_sampler_free(led_output_sampler_t *sampler)
+{
+	free(sampler->spans);
+	free(sampler->area);
+	free(sampler->acc);
+	sampler->spans = NULL;
+	sampler->area = NULL;
+	sampler->acc = NULL;
+	sampler->src_w = sampler->src_h = 0;
+}
+
+/* box bounds [start, end) of each of 'dst' cells over 'src' pixels, never empty */
+static void
+led_output_sampler_spans(uint32_t *start, uint32_t *end, int src, int dst)
+{
+	int i;
+
+	for (i = 0; i < dst; i++) {
+		start[i] = (uint32_t)((int64_t)i * src / dst);
+		end[i] = (uint32_t)((int64_t)(i + 1) * src / dst);
+		if (end[i] <= start[i])
+			end[i] = start[i] + 1;
+	}
+}
+
+pepper_bool_t
+led_output_sampler_prepare(led_output_sampler_t *sampler, int src_w, int src_h, int dst_w, int dst_h)
+{
+	int x, y;
+
+	if (sampler->src_w == src_w && sampler->src_h == src_h &&
+		sampler->dst_w == dst_w && sampler->dst_h == dst_h)
+		return PEPPER_TRUE;
+
+	led_output_sampler_free(sampler);
+
+	sampler->spans = (uint32_t *)calloc(2 * (dst_w + dst_h), sizeof(uint32_t));
+	sampler->area = (uint32_t *)calloc((size_t)dst_w * dst_h, sizeof(uint32_t));
+	sampler->acc = (uint32_t *)calloc((size_t)src_w * 4, sizeof(uint32_t));
+	if (!sampler->spans || !sampler->area || !sampler->acc) {
+		PEPPER_ERROR("[OUTPUT] fail to alloc sampling tables\n");
+		led_output_sampler_free(sampler);
+		return PEPPER_FALSE;
+	}
+
+	sampler->x_start = sampler->spans;
+	sampler->x_end = sampler->x_start + dst_w;
+	sampler->y_start = sampler->x_end + dst_w;
+	sampler->y_end = sampler->y_start + dst_h;
+	led_output_sampler_spans(sampler->x_start, sampler->x_end, src_w, dst_w);
+	led_output_sampler_spans(sampler->y_start, sampler->y_end, src_h, dst_h);
+
+	for (y = 0; y < dst_h; y++) {
+		for (x = 0; x < dst_w; x++) {
+			sampler->area[y * dst_w + x] = (sampler->x_end[x] - sampler->x_start[x]) *
+										   (sampler->y_end[y] - sampler->y_start[y]);
+		}
+	}
+
+	sampler->src_w = src_w;
+	sampler->src_h = src_h;
+	sampler->dst_w = dst_w;
+	sampler->dst_h = dst_h;
+
+	PEPPER_TRACE("[OUTPUT] sampling tables for %dx%d -> %dx%d\n", src_w, src_h, dst_w, dst_h);
+	return PEPPER_TRUE;
+}
+
+static void
+led_output_sampler_accumulate(uint32_t *restrict acc, const uint8_t *restrict src, uint32_t len)
+{
+	uint32_t i = 0;
+#ifdef HAVE_SAMPLE_VECTOR
+	sample_u8x16_t s;
+	sample_u32x16_t a;
+
+	/* 16 bytes at a time with whatever SIMD the target has */
+	for (; i + 16 <= len; i += 16) {
+		memcpy(&s, src + i, sizeof(s));
+		memcpy(&a, acc + i, sizeof(a));
+		a += __builtin_convertvector(s, sample_u32x16_t);
+		memcpy(acc + i, &a, sizeof(a));
+	}
+#endif
+
+	for (; i < len; i++)
+		acc[i] += src[i];
+}
+
+void
+led_output_sampler_run(led_output_sampler_t *sampler, uint8_t *dst, const uint8_t *src, int stride)
+{
+	const uint32_t *remap = sampler->remap;
+	uint64_t sum[4], area;
+	uint32_t *acc, i, c, row, v;
+	uint8_t *out;
+	int x, y;
+
+	/* same size: the layout takes the pixels as they are */
+	if (sampler->src_w == sampler->dst_w && sampler->src_h == sampler->dst_h) {
+		for (y = 0; y < sampler->dst_h; y++) {
+			for (x = 0; x < sampler->dst_w; x++)
+				memcpy(dst + (size_t)*remap++ * 4, src + (size_t)y * stride + x * 4, 4);
+		}
+		return;
+	}
+
+	for (y = 0; y < sampler->dst_h; y++) {
+		memset(sampler->acc, 0, (size_t)sampler->src_w * 4 * sizeof(uint32_t));
+		for (row = sampler->y_start[y]; row < sampler->y_end[y]; row++)
+			led_output_sampler_accumulate(sampler->acc, src + (size_t)row * stride,
+										  (uint32_t)sampler->src_w * 4);
+
+		for (x = 0; x < sampler->dst_w; x++) {
+			sum[0] = sum[1] = sum[2] = sum[3] = 0;
+			for (i = sampler->x_start[x]; i < sampler->x_end[x]; i++) {
+				acc = sampler->acc + i * 4;
+				sum[0] += acc[0];
+				sum[1] += acc[1];
+				sum[2] += acc[2];
+				sum[3] += acc[3];
+			}
+
+			area = sampler->area[y * sampler->dst_w + x];
+			out = dst + (size_t)*remap++ * 4;
+			for (c = 0; c < 4; c++) {
+				v = (uint32_t)((sum[c] + area / 2) / area);
+				out[c] = (uint8_t)(v > 0xFF ? 0xFF : v);
+			}
+		}
+	}
+}
+
+void
+led_output_sampler_fini(led_output_sampler_t *sampler)
+{
+	led_output_sampler_free(sampler);
+	sampler->dst_w = sampler->dst_h = 0;
+}
@@ -32,11 +32,20 @@
 #include <tizen-extension-server-protocol.h>
 
 #include "headless_server.h"
+#include "headless-led-animation-server-protocol.h"
 
 #define UPDATE_SURFACE_TYPE	0		//update the surface_type(map. unmap)
 #define SET_UPDATE(x, type)	(x |= ((uint32_t)(1<<type)))
 #define IS_UPDATE(x, type)	(!!(x & ((uint32_t)(1<<type))))
 
+#define SHELL_CACHELINE_SIZE	64
+#define SHELL_SURFACE_SLAB_SIZE	32	//headless_shell_surface_t records per slab
+#define SHELL_RES_INDEX_SIZE	64	//initial buckets of the res_id index, power of two
+
+#define VIEW_MAPPED		(1 << 0)	//mapped: candidate for the top view
+#define VIEW_FOCUSABLE	(1 << 1)	//mapped and not skip_focus: candidate for the focus view
+#define VIEW_VISIBLE	(1 << 2)	//mapped with a buffer: candidate for the visible view
+
 typedef enum {
 	HEADLESS_SURFACE_NONE,
 	HEADLESS_SURFACE_TOPLEVEL,
@@ -45,28 +54,59 @@ typedef enum {
 
 typedef struct HEADLESS_SHELL headless_shell_t;
 typedef struct HEADLESS_SHELL_SURFACE headless_shell_surface_t;
+typedef struct HEADLESS_SHELL_SLAB headless_shell_slab_t;
+typedef struct HEADLESS_SHELL_LED_ANIM headless_shell_led_anim_t;
 
 struct HEADLESS_SHELL{
 	pepper_compositor_t *compositor;
 	struct wl_global *zxdg_shell;
 	struct wl_global *tizen_policy;
+	struct wl_global *tizen_surface;
+	struct wl_global *led_animation;
 	struct wl_event_source *cb_idle;
 
 	pepper_view_t *focus;
 	pepper_view_t *top_mapped;
 	pepper_view_t *top_visible;
 
+	//For incremental tracking of focus, top_mapped and top_visible
+	struct wl_list dirty_list;
+	pepper_bool_t rescan;
+	pepper_bool_t verify;
+
+	//For visibility changes to be notified at the end of the idle
+	struct wl_list vis_list;
+
+	//For the res_id index
+	headless_shell_surface_t **res_index;
+	uint32_t res_index_size;
+	uint32_t res_index_count;
+	uint32_t next_res_id;
+
+	//For statistics
+	uint64_t commits;
+	uint64_t idles;
+	uint64_t scans;
+	uint64_t vis_notified;
+	uint64_t vis_coalesced;
+
 	pepper_event_listener_t *surface_add_listener;
 	pepper_event_listener_t *surface_remove_listener;
 	pepper_event_listener_t *view_remove_listener;
 };
 
+/* The first cache line holds what commits and the idle touch */
 struct HEADLESS_SHELL_SURFACE{
 	headless_shell_t *hs_shell;
 	pepper_surface_t *surface;
 	pepper_view_t *view;
+	struct wl_list dirty_link;
 	uint32_t	updates;
 	uint8_t		visibility;
+	uint8_t		sent_visibility;	//last visibility notified to the client
+	pepper_bool_t skip_focus;
+	pepper_bool_t has_buffer;
+	pepper_bool_t lowered;
 
 	headless_surface_type_t surface_type;
 	struct wl_resource *zxdg_shell_surface;
@@ -74,18 +114,48 @@ struct HEADLESS_SHELL_SURFACE{
 	struct wl_resource *tizen_visibility;
 	uint32_t last_ack_configure;
 
-	pepper_bool_t skip_focus;
-
 	pepper_event_listener_t *cb_commit;
+
+	uint32_t res_id;
+	headless_shell_surface_t *res_next;
+
+	struct wl_list vis_link;
+
+	headless_shell_surface_t *free_next;
+} __attribute__((aligned(SHELL_CACHELINE_SIZE)));
+
+/* keyframes a headless_led_animation client added since its last play */
+struct HEADLESS_SHELL_LED_ANIM{
+	headless_shell_t *shell;
+	headless_output_keyframe_t *keyframes;
+	int count;
+	int size;
 };
 
+struct HEADLESS_SHELL_SLAB{
+	headless_shell_slab_t *next;
+	headless_shell_surface_t surfaces[SHELL_SURFACE_SLAB_SIZE];
+};
+
+/* Shell surface records outlive the shell: pepper frees them with the
+ * surfaces when the compositor is destroyed, so the pool is not per shell. */
+static struct {
+	headless_shell_slab_t *slabs;
+	headless_shell_surface_t *free_list;
+	uint32_t num_slabs;
+	uint32_t num_free;
+	uint32_t live;
+	uint32_t peak;
+} surface_pool;
+
 static void
 headless_shell_cb_surface_commit(pepper_event_listener_t *listener,
 										pepper_object_t *object,
 										uint32_t id, void *info, void *data);
 static void
 headless_shell_add_idle(headless_shell_t *shell);
-
+static void
+headless_shell_surface_changed(headless_shell_surface_t *hs_surface);
 
 static void
 headless_shell_send_visiblity(pepper_view_t *view, uint8_t visibility);
@@ -105,7 +175,7 @@ zxdg_toplevel_cb_resource_destroy(struct wl_resource *resource)
 
 	if (hs_surface->view) {
 		pepper_view_unmap(hs_surface->view);
-		headless_shell_add_idle(hs_surface->hs_shell);
+		headless_shell_surface_changed(hs_surface);
 	}
 
 	hs_surface->surface_type = HEADLESS_SURFACE_NONE;
@@ -285,6 +355,9 @@ zxdg_surface_cb_resource_destroy(struct wl_resource *resource)
 	hs_surface->zxdg_shell_surface = NULL;
 	hs_surface->skip_focus = PEPPER_FALSE;
 	hs_surface->visibility = TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED;
+	hs_surface->sent_visibility = TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED;
+	wl_list_remove(&hs_surface->vis_link);
+	wl_list_init(&hs_surface->vis_link);
 
 	SET_UPDATE(hs_surface->updates, UPDATE_SURFACE_TYPE);
 	headless_shell_add_idle(hs_surface->hs_shell);
@@ -684,6 +757,7 @@ tizen_policy_cb_vis_get(struct wl_client *client, struct wl_resource *resource,
 
 	if (hs_surface->visibility != TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED)
 		tizen_visibility_send_notify(hs_surface->tizen_visibility, hs_surface->visibility);
+	hs_surface->sent_visibility = hs_surface->visibility;
 }
 
 static void
@@ -704,6 +778,93 @@ tizen_policy_cb_pos_get(struct wl_client *client, struct wl_resource *resource,
 			tizen_position_cb_pos_destroy);
 }
 
+static inline uint32_t
+headless_shell_res_hash(uint32_t res_id, uint32_t size)
+{
+	return (res_id * 2654435761u) & (size - 1);
+}
+
+static void
+headless_shell_res_index_grow(headless_shell_t *shell)
+{
+	headless_shell_surface_t **buckets, *hs_surface, *next;
+	uint32_t size = shell->res_index_size * 2;
+	uint32_t i, h;
+
+	buckets = (headless_shell_surface_t **)calloc(size, sizeof(headless_shell_surface_t *));
+	PEPPER_CHECK(buckets, return, "fail to grow the res_id index\n");
+
+	for (i = 0; i < shell->res_index_size; i++) {
+		for (hs_surface = shell->res_index[i]; hs_surface; hs_surface = next) {
+			next = hs_surface->res_next;
+			h = headless_shell_res_hash(hs_surface->res_id, size);
+			hs_surface->res_next = buckets[h];
+			buckets[h] = hs_surface;
+		}
+	}
+
+	free(shell->res_index);
+	shell->res_index = buckets;
+	shell->res_index_size = size;
+}
+
+static void
+headless_shell_res_index_add(headless_shell_t *shell, headless_shell_surface_t *hs_surface)
+{
+	uint32_t h;
+
+	if (!++shell->next_res_id)
+		shell->next_res_id = 1;
+	hs_surface->res_id = shell->next_res_id;
+
+	if (shell->res_index_count >= shell->res_index_size * 2)
+		headless_shell_res_index_grow(shell);
+
+	h = headless_shell_res_hash(hs_surface->res_id, shell->res_index_size);
+	hs_surface->res_next = shell->res_index[h];
+	shell->res_index[h] = hs_surface;
+	shell->res_index_count++;
+}
+
+static void
+headless_shell_res_index_remove(headless_shell_t *shell, headless_shell_surface_t *hs_surface)
+{
+	headless_shell_surface_t **p;
+
+	p = &shell->res_index[headless_shell_res_hash(hs_surface->res_id, shell->res_index_size)];
+	for (; *p; p = &(*p)->res_next) {
+		if (*p == hs_surface) {
+			*p = hs_surface->res_next;
+			hs_surface->res_next = NULL;
+			shell->res_index_count--;
+			return;
+		}
+	}
+}
+
+static headless_shell_surface_t *
+headless_shell_res_index_find(headless_shell_t *shell, uint32_t res_id)
+{
+	headless_shell_surface_t *hs_surface;
+
+	hs_surface = shell->res_index[headless_shell_res_hash(res_id, shell->res_index_size)];
+	for (; hs_surface; hs_surface = hs_surface->res_next) {
+		if (hs_surface->res_id == res_id)
+			return hs_surface;
+	}
+
+	return NULL;
+}
+
+/* Restacks other than stack_top can move the view down, past the views
+ * the shell tracks. */
+static void
+headless_shell_surface_restacked(headless_shell_surface_t *hs_surface)
+{
+	hs_surface->lowered = PEPPER_TRUE;
+	headless_shell_surface_changed(hs_surface);
+}
+
 static void
 tizen_policy_cb_activate(struct wl_client *client, struct wl_resource *resource, struct wl_resource *surf)
 {
@@ -719,12 +880,26 @@ tizen_policy_cb_activate(struct wl_client *client, struct wl_resource *resource,
 
 	pepper_view_stack_top(hs_surface->view, PEPPER_TRUE);
 
-	headless_shell_add_idle(hs_surface->hs_shell);
+	headless_shell_surface_changed(hs_surface);
 }
 
 static void
 tizen_policy_cb_activate_below_by_res_id(struct wl_client *client, struct wl_resource *resource,  uint32_t res_id, uint32_t below_res_id)
 {
+	headless_shell_t *shell = (headless_shell_t *)wl_resource_get_user_data(resource);
+	headless_shell_surface_t *hs_surface, *hs_above;
+
+	hs_surface = headless_shell_res_index_find(shell, res_id);
+	PEPPER_CHECK(hs_surface && hs_surface->view, return, "invalid res_id:%u\n", res_id);
+
+	hs_above = headless_shell_res_index_find(shell, below_res_id);
+	PEPPER_CHECK(hs_above && hs_above->view, return, "invalid below_res_id:%u\n", below_res_id);
+
+	PEPPER_CHECK(hs_surface != hs_above, return, "cannot stack res_id:%u below itself\n", res_id);
+
+	pepper_view_stack_below(hs_surface->view, hs_above->view, PEPPER_TRUE);
+
+	headless_shell_surface_restacked(hs_surface);
 }
 
 static void
@@ -740,6 +915,15 @@ tizen_policy_cb_lower(struct wl_client *client, struct wl_resource *resource, st
 static void
 tizen_policy_cb_lower_by_res_id(struct wl_client *client, struct wl_resource *resource,  uint32_t res_id)
 {
+	headless_shell_t *shell = (headless_shell_t *)wl_resource_get_user_data(resource);
+	headless_shell_surface_t *hs_surface;
+
+	hs_surface = headless_shell_res_index_find(shell, res_id);
+	PEPPER_CHECK(hs_surface && hs_surface->view, return, "invalid res_id:%u\n", res_id);
+
+	pepper_view_stack_bottom(hs_surface->view, PEPPER_TRUE);
+
+	headless_shell_surface_restacked(hs_surface);
 }
 
 static void
@@ -754,7 +938,11 @@ tizen_policy_cb_focus_skip_set(struct wl_client *client, struct wl_resource *res
 	hs_surface = pepper_object_get_user_data((pepper_object_t *)psurface, surf);
 	PEPPER_CHECK(hs_surface, return, "fail to get headless_shell_surface\n");
 
+	if (hs_surface->skip_focus)
+		return;
+
 	hs_surface->skip_focus = PEPPER_TRUE;
+	headless_shell_surface_changed(hs_surface);
 }
 
 static void
@@ -769,7 +957,11 @@ tizen_policy_cb_focus_skip_unset(struct wl_client *client, struct wl_resource *r
 	hs_surface = pepper_object_get_user_data((pepper_object_t *)psurface, surf);
 	PEPPER_CHECK(hs_surface, return, "fail to get headless_shell_surface\n");
 
+	if (!hs_surface->skip_focus)
+		return;
+
 	hs_surface->skip_focus = PEPPER_FALSE;
+	headless_shell_surface_changed(hs_surface);
 }
 
 static void
@@ -900,6 +1092,20 @@ tizen_policy_cb_stack_mode_set(struct wl_client *client, struct wl_resource *res
 static void
 tizen_policy_cb_activate_above_by_res_id(struct wl_client *client, struct wl_resource *resource,  uint32_t res_id, uint32_t above_res_id)
 {
+	headless_shell_t *shell = (headless_shell_t *)wl_resource_get_user_data(resource);
+	headless_shell_surface_t *hs_surface, *hs_below;
+
+	hs_surface = headless_shell_res_index_find(shell, res_id);
+	PEPPER_CHECK(hs_surface && hs_surface->view, return, "invalid res_id:%u\n", res_id);
+
+	hs_below = headless_shell_res_index_find(shell, above_res_id);
+	PEPPER_CHECK(hs_below && hs_below->view, return, "invalid above_res_id:%u\n", above_res_id);
+
+	PEPPER_CHECK(hs_surface != hs_below, return, "cannot stack res_id:%u above itself\n", res_id);
+
+	pepper_view_stack_above(hs_surface->view, hs_below->view, PEPPER_TRUE);
+
+	headless_shell_surface_restacked(hs_surface);
 }
 
 static void
@@ -1024,6 +1230,278 @@ tizen_policy_deinit(headless_shell_t *shell)
 		wl_global_destroy(shell->tizen_policy);
 }
 
+static void
+tizen_resource_cb_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct tizen_resource_interface tizen_resource_iface =
+{
+	tizen_resource_cb_destroy
+};
+
+static void
+tizen_surface_cb_resource_get(struct wl_client *client, struct wl_resource *resource, uint32_t id, struct wl_resource *surf)
+{
+	pepper_surface_t *psurface;
+	headless_shell_surface_t *hs_surface;
+	struct wl_resource *new_res;
+
+	psurface = wl_resource_get_user_data(surf);
+	PEPPER_CHECK(psurface, return, "fail to get pepper_surface_t\n");
+
+	hs_surface = pepper_object_get_user_data((pepper_object_t *)psurface, surf);
+	PEPPER_CHECK(hs_surface, return, "fail to get headless_shell_surface\n");
+
+	new_res = wl_resource_create(client, &tizen_resource_interface, 1, id);
+	if (!new_res) {
+		PEPPER_ERROR("fail to create tizen_resource");
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(new_res, &tizen_resource_iface, NULL, NULL);
+
+	tizen_resource_send_resource_id(new_res, hs_surface->res_id);
+}
+
+static void
+tizen_surface_cb_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct tizen_surface_interface tizen_surface_iface =
+{
+	tizen_surface_cb_resource_get,
+	tizen_surface_cb_destroy
+};
+
+static void
+tizen_surface_cb_bind(struct wl_client *client, void *data, uint32_t ver, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &tizen_surface_interface, ver, id);
+	PEPPER_CHECK(resource, goto err, "fail to create tizen_surface\n");
+
+	wl_resource_set_implementation(resource, &tizen_surface_iface, data, NULL);
+	return;
+
+err:
+	wl_client_post_no_memory(client);
+}
+
+static pepper_bool_t
+tizen_surface_init(headless_shell_t *shell)
+{
+	struct wl_display *display;
+
+	display = pepper_compositor_get_display(shell->compositor);
+
+	shell->tizen_surface = wl_global_create(display, &tizen_surface_interface, 1, shell, tizen_surface_cb_bind);
+	PEPPER_CHECK(shell->tizen_surface, return PEPPER_FALSE, "faile to create tizen_surface\n");
+
+	return PEPPER_TRUE;
+}
+
+static void
+tizen_surface_deinit(headless_shell_t *shell)
+{
+	if (shell->tizen_surface)
+		wl_global_destroy(shell->tizen_surface);
+}
+
+static void
+led_animation_clear(headless_shell_led_anim_t *anim)
+{
+	int i;
+
+	for (i = 0; i < anim->count; i++)
+		free((void *)anim->keyframes[i].pixels);
+	anim->count = 0;
+}
+
+static void
+led_animation_cb_resource_destroy(struct wl_resource *resource)
+{
+	headless_shell_led_anim_t *anim = (headless_shell_led_anim_t *)wl_resource_get_user_data(resource);
+
+	/* what is playing keeps playing until replaced */
+	led_animation_clear(anim);
+	free(anim->keyframes);
+	free(anim);
+}
+
+static void
+led_animation_cb_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+led_animation_cb_add_keyframe(struct wl_client *client, struct wl_resource *resource,
+							struct wl_resource *buffer, uint32_t duration_ms, uint32_t easing)
+{
+	headless_shell_led_anim_t *anim = (headless_shell_led_anim_t *)wl_resource_get_user_data(resource);
+	headless_output_keyframe_t *keyframes;
+	struct wl_shm_buffer *shm_buffer;
+	const uint8_t *src;
+	uint8_t *pixels;
+	uint32_t format;
+	int32_t stride;
+	int width, height, y;
+
+	if (easing > HEADLESS_LED_ANIMATION_EASING_IN_OUT) {
+		wl_resource_post_error(resource, HEADLESS_LED_ANIMATION_ERROR_INVALID_EASING,
+							"invalid easing %u", easing);
+		return;
+	}
+
+	headless_output_get_layout(anim->shell->compositor, &width, &height);
+
+	shm_buffer = wl_shm_buffer_get(buffer);
+	if (!shm_buffer) {
+		wl_resource_post_error(resource, HEADLESS_LED_ANIMATION_ERROR_INVALID_BUFFER,
+							"keyframes must be wl_shm buffers");
+		return;
+	}
+
+	format = wl_shm_buffer_get_format(shm_buffer);
+	stride = wl_shm_buffer_get_stride(shm_buffer);
+	if ((format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) ||
+		wl_shm_buffer_get_width(shm_buffer) != width ||
+		wl_shm_buffer_get_height(shm_buffer) != height ||
+		stride < width * 4) {
+		wl_resource_post_error(resource, HEADLESS_LED_ANIMATION_ERROR_INVALID_BUFFER,
+							"keyframes must be %dx%d ARGB8888/XRGB8888", width, height);
+		return;
+	}
+
+	if (anim->count >= HEADLESS_OUTPUT_MAX_KEYFRAMES) {
+		wl_resource_post_error(resource, HEADLESS_LED_ANIMATION_ERROR_TOO_MANY_KEYFRAMES,
+							"more than %d keyframes", HEADLESS_OUTPUT_MAX_KEYFRAMES);
+		return;
+	}
+
+	if (anim->count == anim->size) {
+		keyframes = (headless_output_keyframe_t *)realloc(anim->keyframes,
+								sizeof(headless_output_keyframe_t) * (anim->size ? anim->size * 2 : 8));
+		if (!keyframes) {
+			wl_resource_post_no_memory(resource);
+			return;
+		}
+		anim->keyframes = keyframes;
+		anim->size = anim->size ? anim->size * 2 : 8;
+	}
+
+	pixels = (uint8_t *)malloc((size_t)width * height * 4);
+	if (!pixels) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	/* the client can reuse its buffer as soon as the request is handled */
+	wl_shm_buffer_begin_access(shm_buffer);
+	src = (const uint8_t *)wl_shm_buffer_get_data(shm_buffer);
+	for (y = 0; y < height; y++)
+		memcpy(pixels + (size_t)y * width * 4, src + (size_t)y * stride, (size_t)width * 4);
+	wl_shm_buffer_end_access(shm_buffer);
+
+	anim->keyframes[anim->count].pixels = pixels;
+	anim->keyframes[anim->count].duration_ms = duration_ms;
+	anim->keyframes[anim->count].easing = (headless_output_easing_t)easing;
+	anim->count++;
+}
+
+static void
+led_animation_cb_play(struct wl_client *client, struct wl_resource *resource, int32_t repeat)
+{
+	headless_shell_led_anim_t *anim = (headless_shell_led_anim_t *)wl_resource_get_user_data(resource);
+
+	if (!anim->count) {
+		wl_resource_post_error(resource, HEADLESS_LED_ANIMATION_ERROR_NO_KEYFRAMES,
+							"no keyframes to play");
+		return;
+	}
+
+	if (repeat < 0) {
+		wl_resource_post_error(resource, HEADLESS_LED_ANIMATION_ERROR_INVALID_REPEAT,
+							"invalid repeat %d", repeat);
+		return;
+	}
+
+	/* the output keeps its own copy */
+	if (!headless_output_play_keyframes(anim->shell->compositor, anim->keyframes, anim->count, repeat))
+		PEPPER_ERROR("[SHELL] fail to play %d keyframes\n", anim->count);
+
+	led_animation_clear(anim);
+}
+
+static void
+led_animation_cb_stop(struct wl_client *client, struct wl_resource *resource)
+{
+	headless_shell_led_anim_t *anim = (headless_shell_led_anim_t *)wl_resource_get_user_data(resource);
+
+	headless_output_stop_keyframes(anim->shell->compositor);
+}
+
+static const struct headless_led_animation_interface led_animation_iface =
+{
+	led_animation_cb_destroy,
+	led_animation_cb_add_keyframe,
+	led_animation_cb_play,
+	led_animation_cb_stop
+};
+
+static void
+led_animation_cb_bind(struct wl_client *client, void *data, uint32_t ver, uint32_t id)
+{
+	headless_shell_t *shell = (headless_shell_t *)data;
+	headless_shell_led_anim_t *anim;
+	struct wl_resource *resource;
+	int width = 0, height = 0;
+
+	anim = (headless_shell_led_anim_t *)calloc(1, sizeof(headless_shell_led_anim_t));
+	PEPPER_CHECK(anim, goto err, "fail to alloc headless_led_animation\n");
+	anim->shell = shell;
+
+	resource = wl_resource_create(client, &headless_led_animation_interface, ver, id);
+	PEPPER_CHECK(resource, goto err, "fail to create headless_led_animation\n");
+
+	wl_resource_set_implementation(resource, &led_animation_iface, anim,
+								led_animation_cb_resource_destroy);
+
+	headless_output_get_layout(shell->compositor, &width, &height);
+	headless_led_animation_send_layout(resource, width, height);
+	return;
+
+err:
+	free(anim);
+	wl_client_post_no_memory(client);
+}
+
+static pepper_bool_t
+led_animation_init(headless_shell_t *shell)
+{
+	struct wl_display *display;
+
+	display = pepper_compositor_get_display(shell->compositor);
+
+	shell->led_animation = wl_global_create(display, &headless_led_animation_interface, 1, shell, led_animation_cb_bind);
+	PEPPER_CHECK(shell->led_animation, return PEPPER_FALSE, "faile to create headless_led_animation\n");
+
+	return PEPPER_TRUE;
+}
+
+static void
+led_animation_deinit(headless_shell_t *shell)
+{
+	if (shell->led_animation)
+		wl_global_destroy(shell->led_animation);
+}
+
 static void
 headless_shell_send_visiblity(pepper_view_t *view, uint8_t visibility)
 {
@@ -1043,56 +1521,223 @@ headless_shell_send_visiblity(pepper_view_t *view, uint8_t visibility)
 		return;
 	}
 
-	if (hs_surface->tizen_visibility)
-		tizen_visibility_send_notify(hs_surface->tizen_visibility, visibility);
+	/* sent by headless_shell_flush_visibility() once the idle is done */
+	if (wl_list_empty(&hs_surface->vis_link))
+		wl_list_insert(hs_surface->hs_shell->vis_list.prev, &hs_surface->vis_link);
 
 	hs_surface->visibility = visibility;
 	PEPPER_TRACE("[SHELL] Set Visibility hs_surface:%p, visibility:%d\n", hs_surface, visibility);
 }
 
 static void
-headless_shell_cb_idle(void *data)
+headless_shell_flush_visibility(headless_shell_t *hs_shell)
+{
+	headless_shell_surface_t *hs_surface, *tmp;
+	pepper_bool_t sent = PEPPER_FALSE;
+
+	wl_list_for_each_safe(hs_surface, tmp, &hs_shell->vis_list, vis_link) {
+		wl_list_remove(&hs_surface->vis_link);
+		wl_list_init(&hs_surface->vis_link);
+
+		/* changed and changed back within the same idle */
+		if (hs_surface->visibility == hs_surface->sent_visibility) {
+			hs_shell->vis_coalesced++;
+			continue;
+		}
+
+		hs_surface->sent_visibility = hs_surface->visibility;
+
+		if (hs_surface->tizen_visibility) {
+			tizen_visibility_send_notify(hs_surface->tizen_visibility, hs_surface->visibility);
+			hs_shell->vis_notified++;
+			sent = PEPPER_TRUE;
+		}
+	}
+
+	if (sent)
+		wl_display_flush_clients(pepper_compositor_get_display(hs_shell->compositor));
+}
+
+static headless_shell_surface_t *
+headless_shell_get_surface(pepper_view_t *view)
+{
+	pepper_surface_t *surface;
+
+	surface = pepper_view_get_surface(view);
+	PEPPER_CHECK(surface, return NULL, "[SHELL] Invalid object surface:%p\n", surface);
+
+	return pepper_object_get_user_data((pepper_object_t *)surface, pepper_surface_get_resource(surface));
+}
+
+static uint32_t
+headless_shell_view_flags(pepper_view_t *view, headless_shell_surface_t *hs_surface)
+{
+	uint32_t flags = 0;
+
+	if (!pepper_view_is_mapped(view))
+		return 0;
+
+	flags |= VIEW_MAPPED;
+
+	if (!hs_surface->skip_focus)
+		flags |= VIEW_FOCUSABLE;
+
+	if (pepper_surface_get_buffer(hs_surface->surface))
+		flags |= VIEW_VISIBLE;
+
+	return flags;
+}
+
+/* TRUE if 'view' is stacked above 'base'. Walks up from 'base', which is one
+ * of the tracked views and so normally sits close to the top of the stack. */
+static pepper_bool_t
+headless_shell_view_is_above(pepper_view_t *view, pepper_view_t *base)
+{
+	pepper_view_t *v;
+
+	for (v = pepper_view_get_above(base); v; v = pepper_view_get_above(v)) {
+		if (v == view)
+			return PEPPER_TRUE;
+	}
+
+	return PEPPER_FALSE;
+}
+
+/* A tracked view stays valid as long as it still has the property it was
+ * picked for and has not been moved down the stack. */
+static pepper_bool_t
+headless_shell_tracked_is_valid(pepper_view_t *view, uint32_t flag)
+{
+	headless_shell_surface_t *hs_surface;
+
+	if (!view)
+		return PEPPER_TRUE;
+
+	hs_surface = headless_shell_get_surface(view);
+	if (!hs_surface || hs_surface->lowered)
+		return PEPPER_FALSE;
+
+	return !!(headless_shell_view_flags(view, hs_surface) & flag);
+}
+
+static void
+headless_shell_scan(headless_shell_t *hs_shell, pepper_bool_t notify,
+					pepper_view_t **top_ret, pepper_view_t **focus_ret, pepper_view_t **visible_ret)
 {
-	headless_shell_t *hs_shell = (headless_shell_t *)data;
 	const pepper_list_t *list;
 	pepper_list_t *l;
 	pepper_view_t *view;
-	pepper_surface_t *surface;
 	headless_shell_surface_t *hs_surface;
+	uint32_t flags;
 
 	pepper_view_t *focus = NULL, *top = NULL, *top_visible = NULL;
 
-	PEPPER_TRACE("[SHELL] Enter Idle\n");
 	list = pepper_compositor_get_view_list(hs_shell->compositor);
 
 	pepper_list_for_each_list(l,  list) {
 		view = (pepper_view_t *)l->item;
 		PEPPER_CHECK(view, continue, "[SHELL] idle_cb, Invalid object view:%p\n", view);
 
-		surface = pepper_view_get_surface(view);
-		PEPPER_CHECK(surface, continue, "[SHELL] idle_cb, Invalid object surface:%p\n", surface);
-
-		hs_surface = pepper_object_get_user_data((pepper_object_t *)surface, pepper_surface_get_resource(surface));
+		hs_surface = headless_shell_get_surface(view);
 		PEPPER_CHECK(hs_surface, continue, "[SHELL] idle_cb, Invalid object headless_surface:%p\n", hs_surface);
 
-		if (!pepper_view_is_mapped(view)) {
-			headless_shell_send_visiblity(view, TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED);
+		flags = headless_shell_view_flags(view, hs_surface);
+		if (!flags) {
+			if (notify)
+				headless_shell_send_visiblity(view, TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED);
 			continue;
 		}
 
 		if (!top)
 			top = view;
 
-		if (!focus && !hs_surface->skip_focus)
+		if (!focus && (flags & VIEW_FOCUSABLE))
 			focus = view;
 
-		if (!top_visible && pepper_surface_get_buffer(surface))
+		if (!top_visible && (flags & VIEW_VISIBLE))
 			top_visible = view;
 
-		if (top && focus && top_visible)
+		if (top && focus && top_visible && !notify)
 			break;
 	}
 
+	*top_ret = top;
+	*focus_ret = focus;
+	*visible_ret = top_visible;
+}
+
+static void
+headless_shell_cb_idle(void *data)
+{
+	headless_shell_t *hs_shell = (headless_shell_t *)data;
+	headless_shell_surface_t *hs_surface, *tmp;
+	pepper_view_t *view;
+	uint32_t flags;
+
+	pepper_view_t *focus, *top, *top_visible;
+
+	PEPPER_TRACE("[SHELL] Enter Idle\n");
+	hs_shell->idles++;
+
+	top = hs_shell->top_mapped;
+	focus = hs_shell->focus;
+	top_visible = hs_shell->top_visible;
+
+	/* Losing a tracked view means the next one is somewhere below it, which
+	 * only the full scan can find. */
+	if (!hs_shell->rescan &&
+		(!headless_shell_tracked_is_valid(top, VIEW_MAPPED) ||
+		 !headless_shell_tracked_is_valid(focus, VIEW_FOCUSABLE) ||
+		 !headless_shell_tracked_is_valid(top_visible, VIEW_VISIBLE)))
+		hs_shell->rescan = PEPPER_TRUE;
+
+	if (hs_shell->rescan) {
+		hs_shell->scans++;
+		headless_shell_scan(hs_shell, PEPPER_TRUE, &top, &focus, &top_visible);
+	} else {
+		/* Only the changed views can overtake the tracked ones. */
+		wl_list_for_each(hs_surface, &hs_shell->dirty_list, dirty_link) {
+			view = hs_surface->view;
+			if (!view)
+				continue;
+
+			flags = headless_shell_view_flags(view, hs_surface);
+			if (!flags) {
+				headless_shell_send_visiblity(view, TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED);
+				continue;
+			}
+
+			if (!top || headless_shell_view_is_above(view, top))
+				top = view;
+
+			if ((flags & VIEW_FOCUSABLE) && (!focus || headless_shell_view_is_above(view, focus)))
+				focus = view;
+
+			if ((flags & VIEW_VISIBLE) && (!top_visible || headless_shell_view_is_above(view, top_visible)))
+				top_visible = view;
+		}
+	}
+
+	wl_list_for_each_safe(hs_surface, tmp, &hs_shell->dirty_list, dirty_link) {
+		wl_list_remove(&hs_surface->dirty_link);
+		wl_list_init(&hs_surface->dirty_link);
+		hs_surface->lowered = PEPPER_FALSE;
+	}
+	hs_shell->rescan = PEPPER_FALSE;
+
+	if (hs_shell->verify) {
+		pepper_view_t *s_top, *s_focus, *s_visible;
+
+		headless_shell_scan(hs_shell, PEPPER_FALSE, &s_top, &s_focus, &s_visible);
+		if (s_top != top || s_focus != focus || s_visible != top_visible) {
+			PEPPER_ERROR("[SHELL] tracking mismatch top:%p/%p focus:%p/%p visible:%p/%p\n",
+						top, s_top, focus, s_focus, top_visible, s_visible);
+			top = s_top;
+			focus = s_focus;
+			top_visible = s_visible;
+		}
+	}
+
 	if (top != hs_shell->top_mapped) {
 		const pepper_list_t *l;
 		pepper_list_t *ll;
@@ -1123,6 +1768,8 @@ headless_shell_cb_idle(void *data)
 		hs_shell->top_visible = top_visible;
 	}
 
+	headless_shell_flush_visibility(hs_shell);
+
 	hs_shell->cb_idle = NULL;
 }
 
@@ -1132,12 +1779,12 @@ headless_shell_cb_surface_commit(pepper_event_listener_t *listener,
 										uint32_t id, void *info, void *data)
 {
 	headless_shell_surface_t * hs_surface = (headless_shell_surface_t *)data;
+	pepper_bool_t has_buffer, changed = PEPPER_FALSE;
 
 	PEPPER_CHECK(((pepper_object_t *)hs_surface->surface == object), return, "Invalid object\n");
 
-	/*TODO
-	1. Check the changes(buffer, map status...)
-	*/
+	hs_surface->hs_shell->commits++;
+
 	if (IS_UPDATE(hs_surface->updates, UPDATE_SURFACE_TYPE)) {
 		if (hs_surface->surface_type != HEADLESS_SURFACE_NONE)
 			pepper_view_map(hs_surface->view);
@@ -1145,11 +1792,66 @@ headless_shell_cb_surface_commit(pepper_event_listener_t *listener,
 			pepper_view_unmap(hs_surface->view);
 
 		PEPPER_TRACE("Surface type change. view:%p, type:%d, res:%p\n", hs_surface->view, hs_surface->surface_type, hs_surface->zxdg_surface);
+		changed = PEPPER_TRUE;
 	}
 
 	hs_surface->updates = 0;
 
-	headless_shell_add_idle(hs_surface->hs_shell);
+	/* Only a buffer appearing or going away matters for top_visible, not new content */
+	has_buffer = !!pepper_surface_get_buffer(hs_surface->surface);
+	if (has_buffer != hs_surface->has_buffer) {
+		hs_surface->has_buffer = has_buffer;
+		changed = PEPPER_TRUE;
+	}
+
+	/* stacking requests are applied and reported when they arrive, not on commit */
+	if (changed)
+		headless_shell_surface_changed(hs_surface);
+}
+
+static headless_shell_surface_t *
+headless_shell_surface_alloc(void)
+{
+	headless_shell_surface_t *hs_surface;
+	headless_shell_slab_t *slab;
+	void *mem = NULL;
+	int i;
+
+	if (!surface_pool.free_list) {
+		PEPPER_CHECK(!posix_memalign(&mem, SHELL_CACHELINE_SIZE, sizeof(headless_shell_slab_t)),
+					return NULL, "fail to alloc the shell surface slab\n");
+
+		slab = (headless_shell_slab_t *)mem;
+		slab->next = surface_pool.slabs;
+		surface_pool.slabs = slab;
+		surface_pool.num_slabs++;
+
+		for (i = SHELL_SURFACE_SLAB_SIZE - 1; i >= 0; i--) {
+			slab->surfaces[i].free_next = surface_pool.free_list;
+			surface_pool.free_list = &slab->surfaces[i];
+		}
+		surface_pool.num_free += SHELL_SURFACE_SLAB_SIZE;
+	}
+
+	hs_surface = surface_pool.free_list;
+	surface_pool.free_list = hs_surface->free_next;
+	surface_pool.num_free--;
+
+	memset(hs_surface, 0, sizeof(*hs_surface));
+
+	if (++surface_pool.live > surface_pool.peak)
+		surface_pool.peak = surface_pool.live;
+
+	return hs_surface;
+}
+
+static void
+headless_shell_surface_release(headless_shell_surface_t *hs_surface)
+{
+	hs_surface->free_next = surface_pool.free_list;
+	surface_pool.free_list = hs_surface;
+	surface_pool.num_free++;
+	surface_pool.live--;
 }
 
 static void
@@ -1161,7 +1863,9 @@ headless_shell_cb_surface_free(void *data)
 					surface->surface, surface->view,
 					surface->zxdg_shell_surface, surface->zxdg_surface);
 
-	free(surface);
+	wl_list_remove(&surface->dirty_link);
+	wl_list_remove(&surface->vis_link);
+	headless_shell_surface_release(surface);
 }
 
 static void
@@ -1172,12 +1876,16 @@ headless_shell_cb_surface_add(pepper_event_listener_t *listener,
 	headless_shell_surface_t *hs_surface;
 	pepper_surface_t *surface = (pepper_surface_t *)info;
 
-	hs_surface = (headless_shell_surface_t*)calloc(sizeof(headless_shell_surface_t), 1);
+	hs_surface = headless_shell_surface_alloc();
 	PEPPER_CHECK(hs_surface, return, "fail to alloc for headless_shell_surface\n");
 
 	hs_surface->hs_shell = (headless_shell_t *)data;
 	hs_surface->surface = (pepper_surface_t *)surface;
 	hs_surface->visibility = TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED;
+	hs_surface->sent_visibility = TIZEN_VISIBILITY_VISIBILITY_FULLY_OBSCURED;
+	wl_list_init(&hs_surface->dirty_link);
+	wl_list_init(&hs_surface->vis_link);
+	headless_shell_res_index_add(hs_surface->hs_shell, hs_surface);
 
 	pepper_object_set_user_data((pepper_object_t *)surface,
 								pepper_surface_get_resource(surface),
@@ -1197,6 +1905,8 @@ headless_shell_cb_surface_remove(pepper_event_listener_t *listener,
 	hs_surface = pepper_object_get_user_data((pepper_object_t *)surface, pepper_surface_get_resource(surface));
 	PEPPER_TRACE("[SHELL] surface_remove: pepper_surface:%p, headless_shell:%p\n", object, hs_surface);
 
+	headless_shell_res_index_remove((headless_shell_t *)data, hs_surface);
+
 	if (hs_surface->zxdg_surface) {
 		wl_resource_set_user_data(hs_surface->zxdg_surface, NULL);
 		hs_surface->zxdg_surface = NULL;
@@ -1224,14 +1934,32 @@ headless_shell_cb_view_remove(pepper_event_listener_t *listener,
 	pepper_view_t *view = (pepper_view_t *)info;
 	headless_shell_t *shell = (headless_shell_t *)data;
 
-	if (view == shell->top_mapped)
+	/* The views below a removed tracked view are not known here */
+	if (view == shell->top_mapped) {
 		shell->top_mapped = NULL;
+		shell->rescan = PEPPER_TRUE;
+	}
 
-	if (view == shell->top_visible)
+	if (view == shell->top_visible) {
 		shell->top_visible = NULL;
+		shell->rescan = PEPPER_TRUE;
+	}
 
-	if (view == shell->focus)
+	if (view == shell->focus) {
 		shell->focus = NULL;
+		shell->rescan = PEPPER_TRUE;
+	}
+
+	headless_shell_add_idle(shell);
+}
+
+static void
+headless_shell_surface_changed(headless_shell_surface_t *hs_surface)
+{
+	headless_shell_t *shell = hs_surface->hs_shell;
+
+	if (wl_list_empty(&hs_surface->dirty_link))
+		wl_list_insert(&shell->dirty_list, &hs_surface->dirty_link);
 
 	headless_shell_add_idle(shell);
 }
@@ -1251,6 +1979,30 @@ headless_shell_add_idle(headless_shell_t *shell)
 	PEPPER_CHECK(shell->cb_idle, return, "fail to add idle\n");
 }
 
+void
+headless_shell_debug_status(pepper_compositor_t *compositor)
+{
+	headless_shell_t *shell;
+
+	shell = (headless_shell_t *)pepper_object_get_user_data((pepper_object_t *)compositor, &KEY_SHELL);
+	PEPPER_CHECK(shell, return, "[SHELL] no shell\n");
+
+	PEPPER_TRACE("========= [Shell status] =========\n");
+	PEPPER_TRACE("\t commits=%llu, idles=%llu, full scans=%llu, verify=%s\n",
+				(unsigned long long)shell->commits, (unsigned long long)shell->idles,
+				(unsigned long long)shell->scans, shell->verify ? "on" : "off");
+	PEPPER_TRACE("\t top=%p, focus=%p, top_visible=%p\n",
+				shell->top_mapped, shell->focus, shell->top_visible);
+	PEPPER_TRACE("\t visibility notified=%llu, coalesced=%llu\n",
+				(unsigned long long)shell->vis_notified, (unsigned long long)shell->vis_coalesced);
+	PEPPER_TRACE("\t surface pool live=%u, peak=%u, free=%u/%u (slabs:%u, record:%zu bytes)\n",
+				surface_pool.live, surface_pool.peak, surface_pool.num_free,
+				surface_pool.num_slabs * SHELL_SURFACE_SLAB_SIZE, surface_pool.num_slabs,
+				sizeof(headless_shell_surface_t));
+	PEPPER_TRACE("\t res_id index entries=%u, buckets=%u, next res_id=%u\n",
+				shell->res_index_count, shell->res_index_size, shell->next_res_id + 1);
+}
+
 static void
 headless_shell_init_listeners(headless_shell_t *shell)
 {
@@ -1284,9 +2036,28 @@ headless_shell_destroy(headless_shell_t *shell)
 	if (shell->cb_idle)
 		wl_event_source_remove(shell->cb_idle);
 
+	while (!wl_list_empty(&shell->dirty_list)) {
+		struct wl_list *link = shell->dirty_list.next;
+
+		wl_list_remove(link);
+		wl_list_init(link);
+	}
+
+	while (!wl_list_empty(&shell->vis_list)) {
+		struct wl_list *link = shell->vis_list.next;
+
+		wl_list_remove(link);
+		wl_list_init(link);
+	}
+
 	headless_shell_deinit_listeners(shell);
 	zxdg_deinit(shell);
 	tizen_policy_deinit(shell);
+	tizen_surface_deinit(shell);
+	led_animation_deinit(shell);
+
+	free(shell->res_index);
+	shell->res_index = NULL;
 }
 
 void
@@ -1313,10 +2084,23 @@ headless_shell_init(pepper_compositor_t *compositor)
 	shell = (headless_shell_t*)calloc(sizeof(headless_shell_t), 1);
 	PEPPER_CHECK(shell, goto error, "fail to alloc for shell\n");
 	shell->compositor = compositor;
+	wl_list_init(&shell->dirty_list);
+	wl_list_init(&shell->vis_list);
+	shell->rescan = PEPPER_TRUE;
+
+	if (getenv("HEADLESS_SHELL_VERIFY"))
+		shell->verify = PEPPER_TRUE;
 
 	headless_shell_init_listeners(shell);
+
+	shell->res_index = (headless_shell_surface_t **)calloc(SHELL_RES_INDEX_SIZE, sizeof(headless_shell_surface_t *));
+	PEPPER_CHECK(shell->res_index, goto error, "fail to alloc the res_id index\n");
+	shell->res_index_size = SHELL_RES_INDEX_SIZE;
+
 	PEPPER_CHECK(zxdg_init(shell), goto error, "zxdg_init() failed\n");
 	PEPPER_CHECK(tizen_policy_init(shell), goto error, "tizen_policy_init() failed\n");
+	PEPPER_CHECK(tizen_surface_init(shell), goto error, "tizen_surface_init() failed\n");
+	PEPPER_CHECK(led_animation_init(shell), goto error, "led_animation_init() failed\n");
 
 	pepper_object_set_user_data((pepper_object_t *)compositor, &KEY_SHELL, shell, NULL);
 
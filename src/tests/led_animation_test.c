@@ -0,0 +1,195 @@
+/*
+* Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * Drives headless_led_animation on a running headless_server (WAYLAND_DISPLAY):
+ * a valid two keyframe sequence plays, then a keyframe of the wrong size is
+ * rejected with INVALID_BUFFER. Fails when no such server is reachable, so it
+ * is run by hand on the target rather than by make check.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <wayland-client.h>
+#include "headless-led-animation-client-protocol.h"
+
+typedef struct {
+	struct wl_shm *shm;
+	struct headless_led_animation *anim;
+	int width, height;
+} test_t;
+
+static void
+anim_cb_layout(void *data, struct headless_led_animation *anim, int32_t width, int32_t height)
+{
+	test_t *test = (test_t *)data;
+
+	test->width = width;
+	test->height = height;
+}
+
+static const struct headless_led_animation_listener anim_listener = {
+	anim_cb_layout
+};
+
+static void
+registry_cb_global(void *data, struct wl_registry *registry, uint32_t name,
+					const char *interface, uint32_t version)
+{
+	test_t *test = (test_t *)data;
+
+	if (!strcmp(interface, "wl_shm")) {
+		test->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (!strcmp(interface, headless_led_animation_interface.name)) {
+		test->anim = wl_registry_bind(registry, name, &headless_led_animation_interface, 1);
+		headless_led_animation_add_listener(test->anim, &anim_listener, test);
+	}
+}
+
+static void
+registry_cb_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+	registry_cb_global,
+	registry_cb_global_remove
+};
+
+static struct wl_buffer *
+create_buffer(test_t *test, int width, int height, uint32_t color)
+{
+	struct wl_shm_pool *pool;
+	struct wl_buffer *buffer;
+	uint32_t *pixels;
+	size_t size = (size_t)width * height * 4;
+	size_t i;
+	int fd;
+
+	fd = memfd_create("led-keyframe", MFD_CLOEXEC);
+	if (fd < 0 || ftruncate(fd, size) < 0)
+		return NULL;
+
+	pixels = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (pixels == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+
+	for (i = 0; i < size / 4; i++)
+		pixels[i] = color;
+	munmap(pixels, size);
+
+	pool = wl_shm_create_pool(test->shm, fd, size);
+	buffer = wl_shm_pool_create_buffer(pool, 0, width, height, width * 4, WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	return buffer;
+}
+
+int
+main(int argc, char **argv)
+{
+	test_t test = { 0 };
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_buffer *red, *blue, *bad;
+	const struct wl_interface *interface;
+	uint32_t id;
+	int code;
+
+	display = wl_display_connect(NULL);
+	if (!display) {
+		fprintf(stderr, "FAIL: no wayland display\n");
+		return EXIT_FAILURE;
+	}
+
+	registry = wl_display_get_registry(display);
+	wl_registry_add_listener(registry, &registry_listener, &test);
+	wl_display_roundtrip(display);
+	wl_display_roundtrip(display);
+
+	if (!test.anim || !test.shm) {
+		fprintf(stderr, "FAIL: no headless_led_animation or wl_shm global\n");
+		return EXIT_FAILURE;
+	}
+
+	if (test.width <= 0 || test.height <= 0) {
+		fprintf(stderr, "FAIL: no layout event (%dx%d)\n", test.width, test.height);
+		return EXIT_FAILURE;
+	}
+
+	/* a red to blue fade played once */
+	red = create_buffer(&test, test.width, test.height, 0xFFFF0000);
+	blue = create_buffer(&test, test.width, test.height, 0xFF0000FF);
+	if (!red || !blue) {
+		fprintf(stderr, "FAIL: cannot create keyframe buffers\n");
+		return EXIT_FAILURE;
+	}
+
+	headless_led_animation_add_keyframe(test.anim, red, 100, HEADLESS_LED_ANIMATION_EASING_LINEAR);
+	headless_led_animation_add_keyframe(test.anim, blue, 100, HEADLESS_LED_ANIMATION_EASING_IN_OUT);
+	headless_led_animation_play(test.anim, 1);
+
+	if (wl_display_roundtrip(display) < 0) {
+		fprintf(stderr, "FAIL: play was rejected (error %d)\n", wl_display_get_error(display));
+		return EXIT_FAILURE;
+	}
+
+	headless_led_animation_stop(test.anim);
+	if (wl_display_roundtrip(display) < 0) {
+		fprintf(stderr, "FAIL: stop was rejected (error %d)\n", wl_display_get_error(display));
+		return EXIT_FAILURE;
+	}
+
+	/* a keyframe that does not match the layout is a protocol error */
+	bad = create_buffer(&test, test.width + 1, test.height, 0xFF00FF00);
+	if (!bad) {
+		fprintf(stderr, "FAIL: cannot create keyframe buffers\n");
+		return EXIT_FAILURE;
+	}
+
+	headless_led_animation_add_keyframe(test.anim, bad, 100, HEADLESS_LED_ANIMATION_EASING_STEP);
+	if (wl_display_roundtrip(display) >= 0) {
+		fprintf(stderr, "FAIL: a %dx%d keyframe was accepted\n", test.width + 1, test.height);
+		return EXIT_FAILURE;
+	}
+
+	code = wl_display_get_protocol_error(display, &interface, &id);
+	if (interface != &headless_led_animation_interface ||
+		code != HEADLESS_LED_ANIMATION_ERROR_INVALID_BUFFER) {
+		fprintf(stderr, "FAIL: unexpected error %d on %s\n", code, interface ? interface->name : "(none)");
+		return EXIT_FAILURE;
+	}
+
+	wl_display_disconnect(display);
+	printf("PASS\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,227 @@
+/*
+* Copyright © 2019 Samsung Electronics co., Ltd. All Rights Reserved.
+*
+* Permission is hereby granted, free of charge, to any person obtaining a
+* copy of this software and associated documentation files (the "Software"),
+* to deal in the Software without restriction, including without limitation
+* the rights to use, copy, modify, merge, publish, distribute, sublicense,
+* and/or sell copies of the Software, and to permit persons to whom the
+* Software is furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice (including the next
+* paragraph) shall be included in all copies or substantial portions of the
+* Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+* THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+* DEALINGS IN THE SOFTWARE.
+*/
+
+/*
+ * Reads the frames of the virtual LED driver back from its ring, the way an
+ * external tool maps it: the encoding of a known frame, the slot a frame
+ * goes to once the ring wrapped, and no torn frame while a writer runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../output/HL_UI_LED.h"
+
+#define NUM_LED 37
+#define NUM_SLOTS 4
+#define NUM_WRITES 20000
+
+typedef struct {
+	HL_UI_LED_Virtual_Ring *ring;
+	size_t slot_size;
+	uint8_t *frame;
+} reader_t;
+
+static HL_UI_LED_Virtual_Slot *
+reader_slot(reader_t *reader, uint64_t seq)
+{
+	return (HL_UI_LED_Virtual_Slot *)((uint8_t *)(reader->ring + 1) +
+				((seq - 1) % reader->ring->slots) * reader->slot_size);
+}
+
+/* copy frame 'seq' into reader->frame, 0 if it is being written or was replaced */
+static uint32_t
+reader_read(reader_t *reader, uint64_t seq)
+{
+	HL_UI_LED_Virtual_Slot *slot = reader_slot(reader, seq);
+	uint32_t len;
+
+	if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != seq)
+		return 0;
+
+	len = slot->len;
+	if (len > reader->ring->frame_len)
+		return 0;
+	memcpy(reader->frame, slot + 1, len);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != seq)
+		return 0;
+
+	return len;
+}
+
+static int
+check_frame(const uint8_t *frame, uint32_t len, uint8_t header, uint8_t red, uint8_t green, uint8_t blue)
+{
+	const uint8_t *led;
+	uint32_t i;
+
+	if (len != HL_UI_LED_FRAME_LEN(NUM_LED))
+		return 0;
+
+	/* start frame, then one 4 byte word per LED */
+	if (frame[0] || frame[1] || frame[2] || frame[3])
+		return 0;
+
+	for (i = 0, led = frame + 4; i < NUM_LED; i++, led += 4) {
+		if (led[0] != header || led[R_OFF_SET] != red ||
+			led[G_OFF_SET] != green || led[B_OFF_SET] != blue)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void
+fill(HL_UI_LED *handle, uint8_t red, uint8_t green, uint8_t blue)
+{
+	uint32_t i;
+
+	HL_UI_LED_Begin(handle);
+	for (i = 0; i < NUM_LED; i++)
+		HL_UI_LED_Set_Pixel_RGB(handle, i, red, green, blue);
+	HL_UI_LED_Commit(handle);
+}
+
+static void *
+writer_main(void *data)
+{
+	HL_UI_LED *handle = (HL_UI_LED *)data;
+	uint32_t i;
+
+	/* every LED of frame i has the same colour, a torn frame mixes two */
+	for (i = 0; i < NUM_WRITES; i++)
+		fill(handle, (uint8_t)i, (uint8_t)(i >> 8), (uint8_t)~i);
+
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	HL_UI_LED_Param param;
+	HL_UI_LED *handle;
+	reader_t reader;
+	pthread_t writer;
+	struct stat st;
+	uint64_t seq, first, reads = 0;
+	uint32_t len, i;
+	uint8_t header;
+	int fd;
+
+	memset(&param, 0, sizeof(param));
+	param.slots = NUM_SLOTS;
+	param.brightness = 31;
+
+	handle = HL_UI_LED_Init_Driver(NUM_LED, &HL_UI_LED_Driver_Virtual, &param);
+	if (!handle) {
+		fprintf(stderr, "FAIL: cannot open the virtual driver\n");
+		return EXIT_FAILURE;
+	}
+
+	/* compare whole frames, not the changed part only */
+	HL_UI_LED_Set_Truncate(handle, 0);
+	header = HL_UI_LED_Get_Header(handle);
+
+	fd = HL_UI_LED_Virtual_Get_Fd(handle);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		fprintf(stderr, "FAIL: no ring fd\n");
+		return EXIT_FAILURE;
+	}
+
+	reader.ring = (HL_UI_LED_Virtual_Ring *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (reader.ring == MAP_FAILED) {
+		fprintf(stderr, "FAIL: cannot map the ring\n");
+		return EXIT_FAILURE;
+	}
+
+	if (__atomic_load_n(&reader.ring->magic, __ATOMIC_ACQUIRE) != HL_UI_LED_VIRTUAL_MAGIC ||
+		reader.ring->number != NUM_LED || reader.ring->slots != NUM_SLOTS ||
+		reader.ring->frame_len < HL_UI_LED_FRAME_LEN(NUM_LED)) {
+		fprintf(stderr, "FAIL: bad ring header\n");
+		return EXIT_FAILURE;
+	}
+
+	reader.slot_size = HL_UI_LED_VIRTUAL_SLOT_SIZE(reader.ring->frame_len);
+	reader.frame = (uint8_t *)malloc(reader.ring->frame_len);
+	if (!reader.frame)
+		return EXIT_FAILURE;
+
+	/* a known frame, then enough frames to wrap the ring */
+	first = __atomic_load_n(&reader.ring->sequence, __ATOMIC_ACQUIRE) + 1;
+	for (i = 0; i < NUM_SLOTS + 2; i++)
+		fill(handle, (uint8_t)(0x10 + i), 0x80, (uint8_t)(0xF0 - i));
+
+	seq = __atomic_load_n(&reader.ring->sequence, __ATOMIC_ACQUIRE);
+	if (seq != first + NUM_SLOTS + 1) {
+		fprintf(stderr, "FAIL: %llu frames in the ring, expected %llu\n",
+				(unsigned long long)seq, (unsigned long long)(first + NUM_SLOTS + 1));
+		return EXIT_FAILURE;
+	}
+
+	for (i = 2; i < NUM_SLOTS + 2; i++) {
+		len = reader_read(&reader, first + i);
+		if (!check_frame(reader.frame, len, header, (uint8_t)(0x10 + i), 0x80, (uint8_t)(0xF0 - i))) {
+			fprintf(stderr, "FAIL: frame %u does not match what was written\n", i);
+			return EXIT_FAILURE;
+		}
+	}
+
+	/* frames older than the ring are overwritten */
+	if (reader_read(&reader, first) != 0) {
+		fprintf(stderr, "FAIL: frame %llu is still readable\n", (unsigned long long)first);
+		return EXIT_FAILURE;
+	}
+
+	/* a frame that reads consistently is never a mix of two */
+	if (pthread_create(&writer, NULL, writer_main, handle) != 0)
+		return EXIT_FAILURE;
+
+	do {
+		seq = __atomic_load_n(&reader.ring->sequence, __ATOMIC_ACQUIRE);
+		len = reader_read(&reader, seq);
+		if (!len)
+			continue;
+
+		reads++;
+		if (!check_frame(reader.frame, len, header, reader.frame[4 + R_OFF_SET],
+						reader.frame[4 + G_OFF_SET], reader.frame[4 + B_OFF_SET])) {
+			fprintf(stderr, "FAIL: frame %llu is torn\n", (unsigned long long)seq);
+			return EXIT_FAILURE;
+		}
+	} while (seq < first + NUM_SLOTS + 1 + NUM_WRITES);
+
+	pthread_join(writer, NULL);
+
+	munmap(reader.ring, (size_t)st.st_size);
+	free(reader.frame);
+	HL_UI_LED_Close(handle);
+
+	printf("PASS (%llu frames read while writing)\n", (unsigned long long)reads);
+	return EXIT_SUCCESS;
+}